@@ -0,0 +1,329 @@
+// Loopback benchmarks of the stream transports: ping-pong latency by message size,
+// streaming throughput, and a connections x threads matrix.
+//
+//   make && ./net-bench --quick
+//   ./net-bench --transport inline_poll --transport shm
+//
+// Each transport connects pairs of streams; the server end of a pair is served by a thread
+// of its own, so the numbers include the transport's waiting and waking, not just copying.
+// A new transport is one more class with connect() and an entry in main().
+
+#include <boost/program_options.hpp>
+
+#include "asio.hpp"
+#include "histogram.hpp"
+#include "ipc.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr auto patience = 30s; // read timeout: a stuck benchmark fails instead of hanging
+
+uint64_t ns_since(clock_type::time_point t0)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - t0).count();
+}
+
+std::string human(size_t bytes)
+{
+    if (bytes >= (1 << 20)) return std::to_string(bytes >> 20) + "MB";
+    if (bytes >= (1 << 10)) return std::to_string(bytes >> 10) + "KB";
+    return std::to_string(bytes) + "B";
+}
+
+// Socket over 127.0.0.1, in either IOMode
+class TcpTransport
+{
+public:
+    using Stream = Socket;
+
+    explicit TcpTransport(IOMode mode):work(io_service), server(io_service), client(io_service)
+    {
+        server.set_io_mode(mode);
+        client.set_io_mode(mode);
+        server.listen(port);
+        // handoff Sockets wait for these threads to run their operations
+        unsigned int n = std::max(2u, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < n; i++)
+            io_threads.emplace_back([this]() { io_service.run(); });
+    }
+    ~TcpTransport()
+    {
+        io_service.stop();
+        for (auto& t : io_threads) t.join();
+    }
+
+    std::pair<Socket, Socket> connect()
+    {
+        auto accepted = std::async(std::launch::async, [this]() { return server.accept(); });
+        Socket c = client.connect("127.0.0.1", port);
+        Socket s = accepted.get();
+        for (Socket* p : {&c, &s}) {
+            p->set_read_timeout(patience);
+            boost::system::error_code ignored;
+            p->get_sock_ptr()->set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+        }
+        return {std::move(c), std::move(s)};
+    }
+
+private:
+    boost::asio::io_service io_service;
+    boost::asio::io_service::work work;
+    SyncBoostIO server, client;
+    unsigned short port = 0;
+    std::vector<std::thread> io_threads;
+};
+
+class UnixTransport
+{
+public:
+    using Stream = UnixSocket;
+
+    UnixTransport():path("/tmp/oy-bench-" + std::to_string(::getpid()) + ".sock"), listener(io_service, path){}
+
+    std::pair<UnixSocket, UnixSocket> connect()
+    {
+        auto accepted = std::async(std::launch::async, [this]() { return listener.accept(); });
+        UnixSocket c(io_service);
+        c.connect(path);
+        UnixSocket s = accepted.get();
+        c.set_read_timeout(patience);
+        s.set_read_timeout(patience);
+        return {std::move(c), std::move(s)};
+    }
+
+private:
+    boost::asio::io_service io_service;
+    std::string path;
+    UnixListener listener;
+};
+
+#ifdef __linux__
+class ShmTransport
+{
+public:
+    using Stream = ShmChannel;
+
+    std::pair<ShmChannel, ShmChannel> connect()
+    {
+        std::string name = "/oy-bench-" + std::to_string(::getpid()) + "-" + std::to_string(next++);
+        ShmChannel c = ShmChannel::create(name, 256 << 10);
+        ShmChannel s = ShmChannel::open(name);
+        c.set_read_timeout(patience);
+        s.set_read_timeout(patience);
+        return {std::move(c), std::move(s)};
+    }
+
+private:
+    unsigned int next = 0;
+};
+#endif
+
+struct Options
+{
+    bool quick = false;
+    std::vector<std::string> transports; // empty: all
+    double cell_seconds = 0.5;           // per matrix cell
+};
+
+/**
+ * Ping-pong: the client sends size bytes, the server sends them back, one round trip at a time.
+ * Iterations shrink with the size, so that each size moves about the same number of bytes.
+ */
+template <typename Transport>
+void ping_pong(Transport& transport, const Options& opt)
+{
+    std::printf("  %-8s %10s %10s %10s %10s %10s\n", "size", "p50 us", "p99 us", "p999 us", "max us", "MB/s");
+    for (size_t size : {8, 64, 512, 4 << 10, 32 << 10, 256 << 10, 1 << 20}) {
+        size_t budget = opt.quick ? (16 << 20) : (256 << 20);
+        size_t iterations = std::clamp<size_t>(budget / size, opt.quick ? 100 : 1000, opt.quick ? 2000 : 20000);
+        auto [c, s] = transport.connect();
+        std::thread server([&, s = std::move(s)]() mutable {
+            std::vector<char> buf(size);
+            for (size_t i = 0; i < iterations; i++) {
+                s.read(buf.data(), size);
+                s.write(buf.data(), size);
+            }
+        });
+        std::vector<char> out(size, 'x'), in(size);
+        LogHistogram rtt;
+        auto t0 = clock_type::now();
+        for (size_t i = 0; i < iterations; i++) {
+            auto t = clock_type::now();
+            c.write(out.data(), size);
+            c.read(in.data(), size);
+            rtt.record(ns_since(t));
+        }
+        double secs = ns_since(t0) / 1e9;
+        server.join();
+        std::printf("  %-8s %10.1f %10.1f %10.1f %10.1f %10.1f\n", human(size).c_str(),
+                    rtt.percentile(0.5) / 1e3, rtt.percentile(0.99) / 1e3, rtt.percentile(0.999) / 1e3,
+                    rtt.max() / 1e3, 2.0 * size * iterations / secs / (1 << 20));
+    }
+}
+
+// Streaming: the client writes chunk-sized messages back to back, the server reads them and acks the end.
+template <typename Transport>
+void throughput(Transport& transport, const Options& opt)
+{
+    size_t total = opt.quick ? (64 << 20) : (1 << 30);
+    for (size_t chunk : {size_t(4 << 10), size_t(64 << 10), size_t(1 << 20)}) {
+        auto [c, s] = transport.connect();
+        std::thread server([&, s = std::move(s)]() mutable {
+            std::vector<char> buf(chunk);
+            for (size_t got = 0; got < total; got += chunk)
+                s.read(buf.data(), chunk);
+            s.write(char(1));
+        });
+        std::vector<char> out(chunk, 'x');
+        auto t0 = clock_type::now();
+        for (size_t sent = 0; sent < total; sent += chunk)
+            c.write(out.data(), chunk);
+        c.template read<char>();
+        double secs = ns_since(t0) / 1e9;
+        server.join();
+        std::printf("  %-8s %10.1f MB/s\n", human(chunk).c_str(), total / secs / (1 << 20));
+    }
+}
+
+/**
+ * n connections, driven by m client threads for cell_seconds: each thread does 64-byte round
+ * trips over its share of the connections in turn. Each connection has a server thread.
+ * Reports round trips per second over all connections.
+ */
+template <typename Transport>
+void matrix(Transport& transport, const Options& opt)
+{
+    constexpr size_t size = 64;
+    std::vector<unsigned int> conns {1, 4, 16, 64}, threads {1, 2, 4, 8};
+    if (opt.quick) conns.pop_back();
+    std::printf("  %-10s", "conn\\thr");
+    for (unsigned int m : threads) std::printf(" %10u", m);
+    std::printf("\n");
+    for (unsigned int n : conns) {
+        std::printf("  %-10u", n);
+        for (unsigned int m : threads) {
+            if (m > n) {
+                std::printf(" %10s", "-");
+                continue;
+            }
+            std::vector<typename Transport::Stream> clients;
+            std::vector<std::thread> servers;
+            for (unsigned int i = 0; i < n; i++) {
+                auto [c, s] = transport.connect();
+                clients.push_back(std::move(c));
+                servers.emplace_back([s = std::move(s)]() mutable {
+                    char buf[size];
+                    while (true) {
+                        s.read(buf, size);
+                        if (buf[0] == 1) return; // stop
+                        s.write(buf, size);
+                    }
+                });
+            }
+            std::atomic<bool> done {false};
+            std::atomic<uint64_t> trips {0};
+            std::vector<std::thread> workers;
+            auto t0 = clock_type::now();
+            for (unsigned int t = 0; t < m; t++) {
+                workers.emplace_back([&, t]() {
+                    char buf[size] = {};
+                    uint64_t mine = 0;
+                    while (not done.load(std::memory_order_relaxed)) {
+                        for (unsigned int i = t; i < n; i += m) {
+                            clients[i].write(buf, size);
+                            clients[i].read(buf, size);
+                            mine++;
+                        }
+                    }
+                    trips += mine;
+                });
+            }
+            std::this_thread::sleep_for(std::chrono::duration<double>(opt.cell_seconds));
+            done = true;
+            for (auto& w : workers) w.join();
+            double secs = ns_since(t0) / 1e9;
+            char stop[size] = {1};
+            for (auto& c : clients) c.write(stop, size);
+            for (auto& s : servers) s.join();
+            std::printf(" %10.0f", trips / secs);
+            std::fflush(stdout);
+        }
+        std::printf("\n");
+    }
+}
+
+template <typename Transport>
+void run(const std::string& name, Transport& transport, const Options& opt)
+{
+    std::printf("== %s\n", name.c_str());
+    std::printf(" ping-pong\n");
+    ping_pong(transport, opt);
+    std::printf(" throughput\n");
+    throughput(transport, opt);
+    std::printf(" round trips/s of 64B\n");
+    matrix(transport, opt);
+    std::fflush(stdout);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    namespace po = boost::program_options;
+    Options opt;
+    po::options_description desc("net-bench options");
+    desc.add_options()
+        ("help,h", "this help")
+        ("quick,q", po::bool_switch(&opt.quick), "fewer iterations and smaller transfers")
+        ("transport,t", po::value(&opt.transports), "handoff, inline_poll, unix or shm; repeatable, all by default")
+        ("cell-seconds", po::value(&opt.cell_seconds)->default_value(opt.cell_seconds), "duration of each matrix cell");
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+        std::cout << desc << "\n";
+        return 0;
+    }
+    if (opt.quick && vm["cell-seconds"].defaulted()) opt.cell_seconds = 0.1;
+    auto wanted = [&](const std::string& name) {
+        return opt.transports.empty() || std::find(opt.transports.begin(), opt.transports.end(), name) != opt.transports.end();
+    };
+
+    std::printf("%u cpus\n", std::thread::hardware_concurrency());
+    if (wanted("handoff")) {
+        TcpTransport t(IOMode::handoff);
+        run("Socket, IOMode::handoff (tcp)", t, opt);
+    }
+    if (wanted("inline_poll")) {
+        TcpTransport t(IOMode::inline_poll);
+        run("Socket, IOMode::inline_poll (tcp)", t, opt);
+    }
+    if (wanted("unix")) {
+        UnixTransport t;
+        run("UnixSocket", t, opt);
+    }
+#ifdef __linux__
+    if (wanted("shm")) {
+        ShmTransport t;
+        run("ShmChannel", t, opt);
+    }
+#endif
+    return 0;
+}
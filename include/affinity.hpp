@@ -0,0 +1,144 @@
+#ifndef _GITHUB_SCINART_CPPLIB_AFFINITY_HPP_
+#define _GITHUB_SCINART_CPPLIB_AFFINITY_HPP_
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace oy
+{
+
+/**
+ * Parse the kernel cpulist format, e.g. "0-3,8,10-11".
+ */
+inline std::vector<int> parse_cpu_list(const std::string& s)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(s);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.find_first_of("0123456789") == std::string::npos)
+            continue;
+        auto dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash+1));
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+namespace detail
+{
+inline std::vector<int> read_cpu_list(const std::string& path)
+{
+    std::ifstream in(path);
+    std::string s;
+    std::getline(in, s);
+    return parse_cpu_list(s);
+}
+}
+
+/**
+ * cpus this process may run on.
+ */
+inline std::vector<int> allowed_cpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        return cpus;
+    }
+#endif
+    for (unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+        cpus.push_back(cpu);
+    return cpus;
+}
+
+/**
+ * allowed cpus of each NUMA node, indexed by node id, read from /sys/devices/system/node.
+ * Without NUMA information, one node holding all allowed cpus.
+ */
+inline std::vector<std::vector<int>> numa_nodes()
+{
+    auto allowed = allowed_cpus();
+    std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+    for (int node : detail::read_cpu_list("/sys/devices/system/node/online")) {
+        std::vector<int> cpus;
+        for (int cpu : detail::read_cpu_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))
+            if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                cpus.push_back(cpu);
+        if (nodes.size() <= static_cast<size_t>(node))
+            nodes.resize(node+1);
+        nodes[node] = std::move(cpus);
+    }
+#endif
+    if (nodes.empty())
+        nodes.push_back(std::move(allowed));
+    return nodes;
+}
+
+/**
+ * Pin the calling thread to one cpu.
+ * return false if the platform cannot, or the cpu is not allowed.
+ */
+inline bool pin_this_thread(int cpu)
+{
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+/**
+ * cpu the calling thread is running on, -1 if unknown.
+ */
+inline int current_cpu()
+{
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Where the workers of a Distributor run: one worker per entry of cpus, pinned to it.
+ */
+struct Placement
+{
+    std::vector<int> cpus;
+
+    static Placement cores(std::vector<int> cpus) { return Placement{std::move(cpus)}; }
+    static Placement node(unsigned int n)
+    {
+        auto nodes = numa_nodes();
+        return Placement{n < nodes.size() ? nodes[n] : std::vector<int>{}};
+    }
+    static Placement all() { return Placement{allowed_cpus()}; }
+};
+
+}
+
+#endif
@@ -1,15 +1,49 @@
 #ifndef _GITHUB_SCINART_CPPLIB_ASIO_HPP_
 #define _GITHUB_SCINART_CPPLIB_ASIO_HPP_
 
+#include <utility> // before boost/asio.hpp, whose C++20 parts use std::exchange without including it
 #include <boost/asio.hpp>
 #include <boost/optional.hpp>
+#include <boost/version.hpp>
 #include <string>
+#include <string_view>
+#include <array>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+#include <deque>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include <type_traits>
 #include <memory>
 #include <chrono>
 #include <future>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cerrno>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#endif
 
+#include "affinity.hpp"
 #include "semaphore.hpp"
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+#include <map>
+#include "histogram.hpp"
+#endif
 
 namespace oy
 {
@@ -20,104 +54,964 @@ template<typename...> using __my_void_t = void;
 template <typename T, typename=void> struct is_container : std::false_type {};
 template <typename T>                struct is_container <T, __my_void_t< typename T::value_type > > : std::true_type {};
 
+namespace detail
+{
+// the bytes of a trivially copyable object, or of a contiguous container's elements
+template <typename T>
+auto as_buffer(T& t)
+{
+    using U = std::remove_const_t<T>;
+    if constexpr (is_container<U>::value) {
+        static_assert(std::is_trivially_copyable<typename U::value_type>::value && not std::is_pointer<typename U::value_type>::value,
+                      "reads and writes copy bytes: elements must be trivially copyable and not pointers; see codec.hpp for other types");
+        return boost::asio::buffer(t, t.size() * sizeof(typename U::value_type));
+    } else {
+        static_assert(std::is_trivially_copyable<U>::value && not std::is_pointer<U>::value,
+                      "reads and writes copy bytes: T must be trivially copyable and not a pointer; see codec.hpp for other types");
+        return boost::asio::buffer(&t, sizeof(T));
+    }
+}
+
+// wait in poll() until fd is ready for events; false once deadline passed.
+inline bool poll_ready(int fd, short events, std::chrono::steady_clock::time_point deadline)
+{
+    while (true) {
+        int wait_ms = -1;
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0) return false;
+            wait_ms = int(left.count());
+        }
+        pollfd p{fd, events, 0};
+        int r = ::poll(&p, 1, wait_ms);
+        if (r > 0) return true; // errors and hang-ups show up in the next call too
+        if (r < 0 && errno != EINTR)
+            throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+    }
+}
+
+// read at least one byte from the non-blocking socket fd; throw try_again after deadline, eof at the end.
+inline size_t recv_some(int fd, boost::asio::mutable_buffer buffer, std::chrono::steady_clock::time_point deadline)
+{
+    while (true) {
+        ssize_t n = ::recv(fd, buffer.data(), buffer.size(), 0);
+        if (n > 0) return size_t(n);
+        if (n == 0)
+            throw boost::system::system_error(boost::asio::error::eof);
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+        if (not poll_ready(fd, POLLIN, deadline))
+            throw boost::system::system_error(boost::asio::error::try_again);
+    }
+}
+
+// write all of bufs[0, count) to the non-blocking socket fd, 16 buffers per sendmsg; throw try_again after deadline.
+inline void send_all(int fd, const boost::asio::const_buffer* bufs, size_t count, std::chrono::steady_clock::time_point deadline)
+{
+    size_t offset = 0; // into bufs[0]
+    while (true) {
+        while (count && bufs->size() == offset) {
+            bufs++;
+            count--;
+            offset = 0;
+        }
+        if (count == 0) return;
+        iovec iov[16];
+        size_t k = std::min<size_t>(count, 16);
+        for (size_t i = 0; i < k; i++) {
+            iov[i].iov_base = const_cast<void*>(bufs[i].data());
+            iov[i].iov_len = bufs[i].size();
+        }
+        iov[0].iov_base = static_cast<char*>(iov[0].iov_base) + offset;
+        iov[0].iov_len -= offset;
+        msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = k;
+        ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+            if (not poll_ready(fd, POLLOUT, deadline))
+                throw boost::system::system_error(boost::asio::error::try_again);
+            continue;
+        }
+        for (size_t left = n; left; ) {
+            size_t step = std::min(left, bufs->size() - offset);
+            offset += step;
+            left -= step;
+            if (offset == bufs->size() && left) {
+                bufs++;
+                count--;
+                offset = 0;
+            }
+        }
+    }
+}
+
+/**
+ * The typed read/write interface of the blocking streams (Socket, UnixSocket, ShmChannel),
+ * so code written against one runs on the others.
+ * Derived provides read_buffer(mutable_buffer), filling all of it, and
+ * write_buffers(const const_buffer*, count), writing all of them in order.
+ */
+template <typename Derived>
+class TypedStream
+{
+    // read and write copy bytes: a pointer, or an object owning memory, would arrive dangling
+    template <typename T>
+    static constexpr void check_bitwise()
+    {
+        static_assert(std::is_trivially_copyable<T>::value && not std::is_pointer<T>::value,
+                      "read/write copy bytes: T must be trivially copyable and not a pointer; see codec.hpp for other types");
+    }
+    template <typename T>
+    static constexpr void check_element()
+    {
+        if constexpr (is_container<T>::value)
+            check_bitwise<typename T::value_type>();
+        else
+            check_bitwise<T>();
+    }
+public:
+    template<typename Container> std::enable_if_t<is_container<std::remove_reference_t<Container>>::value, void> write (Container&& t) { return write(t, t.size()); }
+    template<typename Container> std::enable_if_t<is_container<std::remove_reference_t<Container>>::value, void> write (Container&& t, size_t sz) {
+        check_bitwise<typename std::remove_reference_t<Container>::value_type>();
+        boost::asio::const_buffer buffer = boost::asio::buffer(t, sz * sizeof(typename std::remove_reference_t<Container>::value_type));
+        derived().write_buffers(&buffer, 1);
+    }
+
+    template<typename T> std::enable_if_t<!is_container<T>::value, void> write (const T& t) { return write(&t, 1); }
+    template<typename T> std::enable_if_t<!is_container<T>::value, void> write (T* p, size_t nmemb) {
+        check_bitwise<std::remove_const_t<T>>();
+        boost::asio::const_buffer buffer = boost::asio::buffer(p, nmemb * sizeof(T));
+        derived().write_buffers(&buffer, 1);
+    }
+
+    /**
+     * Write several objects and containers, each as write() would, with a single
+     * gathering call:
+     *   sock.write_all(header, payload, std::string("trailer"));
+     */
+    template<typename... Ts> void write_all (const Ts&... ts) {
+        (check_element<Ts>(), ...);
+        std::array<boost::asio::const_buffer, sizeof...(Ts)> buffers {boost::asio::const_buffer(as_buffer(ts))...};
+        derived().write_buffers(buffers.data(), buffers.size());
+    }
+    // bufs[0, count) with a single gathering write
+    void write_gather (const boost::asio::const_buffer* bufs, size_t count) { derived().write_buffers(bufs, count); }
+
+    template<typename T> T read () {
+        T t;
+        read(t);
+        return t;
+    }
+
+    template<typename T> std::vector<T> read (size_t n) {
+        std::vector<T> v(n);
+        read(v);
+        return v;
+    }
+
+    template<typename Container> std::enable_if_t<is_container<std::remove_reference_t<Container>>::value, void> read (Container& t) { return read(t, t.size()); }
+    template<typename Container> std::enable_if_t<is_container<std::remove_reference_t<Container>>::value, void> read (Container& t, size_t sz) {
+        check_bitwise<typename std::remove_reference_t<Container>::value_type>();
+        derived().read_buffer(boost::asio::buffer(t, sz * sizeof(typename std::remove_reference_t<Container>::value_type)));
+    }
+
+    template<typename T> std::enable_if_t<!is_container<T>::value, void> read (T& t) { return read(&t, 1); }
+    template<typename T> std::enable_if_t<!is_container<T>::value, void> read (T* p, size_t nmemb) {
+        check_bitwise<T>();
+        derived().read_buffer(boost::asio::buffer(p, nmemb * sizeof(T)));
+    }
+
+protected:
+    TypedStream() = default;
+private:
+    Derived& derived() { return static_cast<Derived&>(*this); }
+};
+}
+
+#if __cpp_impl_coroutine >= 201902L
+namespace detail
+{
+/**
+ * Awaiter of one asio operation, started by initiate(handler) with handler(ec, bytes).
+ * The coroutine resumes on the io_service thread completing it.
+ * With a timeout, a timer cancels the socket's operations when it expires, and
+ * the coroutine resumes once both the operation and the timer handlers have run.
+ * The timer handler runs on executor, a strand when the socket is shared.
+ */
+template <typename Initiate, typename Executor = boost::asio::ip::tcp::socket::executor_type>
+class AsioAwaiter
+{
+    Initiate initiate;
+    boost::asio::ip::tcp::socket& sock;
+    Executor executor;
+    std::chrono::milliseconds timeout;
+    boost::optional<boost::asio::steady_timer> timer;
+    std::atomic<int> pending {0};
+    bool expired = false;
+    boost::system::error_code ec;
+    size_t n = 0;
+    std::coroutine_handle<> h;
+
+    void done() { if (pending.fetch_sub(1) == 1) h.resume(); }
+public:
+    AsioAwaiter(Initiate initiate_, boost::asio::ip::tcp::socket& sock_, std::chrono::milliseconds timeout_)
+        :initiate(std::move(initiate_)), sock(sock_), executor(sock_.get_executor()), timeout(timeout_){}
+    AsioAwaiter(Initiate initiate_, boost::asio::ip::tcp::socket& sock_, Executor executor_, std::chrono::milliseconds timeout_)
+        :initiate(std::move(initiate_)), sock(sock_), executor(executor_), timeout(timeout_){}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h_)
+    {
+        h = h_;
+        pending = timeout.count() > 0 ? 2 : 1;
+        if (timeout.count() > 0) {
+#if BOOST_VERSION >= 107000
+            timer.emplace(sock.get_executor());
+#else
+            timer.emplace(sock.get_io_service());
+#endif
+            timer->expires_after(timeout);
+            timer->async_wait(boost::asio::bind_executor(executor, [this](const boost::system::error_code& timer_ec) {
+                if (not timer_ec) {
+                    expired = true;
+                    boost::system::error_code ignored;
+                    sock.cancel(ignored);
+                }
+                done();
+            }));
+        }
+        initiate([this](const boost::system::error_code& ec_, size_t n_) {
+            ec = ec_;
+            n = n_;
+            if (timer) timer->cancel();
+            done();
+        });
+    }
+    size_t await_resume()
+    {
+        if (expired && ec == boost::asio::error::operation_aborted)
+            throw boost::system::system_error(boost::asio::error::try_again);
+        if (ec)
+            throw boost::system::system_error(ec);
+        return n;
+    }
+};
+}
+#endif
+
+/**
+ * A semaphore for code running on an io_service: async_wait(handler) takes a unit and calls
+ * handler(error_code) through the io_service, so nothing ever blocks a thread.
+ * The timed async_wait completes with error::timed_out if no unit came in time,
+ * and cancel() completes all pending waits with error::operation_aborted.
+ * Units go to waits in FIFO order. release() and the waits may come from any thread.
+ *
+ * Pending waits are intrusive nodes recycled through a free list, holding handlers of up to
+ * InlineHandler bytes in place: in a steady state waiting allocates nothing.
+ * Destroying it drops the pending waits without calling their handlers; their timers may
+ * still complete afterwards and do nothing. Destroy it only once no released or cancelled
+ * wait is left to run, and not while one of its handlers is running.
+ */
+class AsyncSemaphore
+{
+public:
+    static constexpr size_t InlineHandler = 64;
+
+    AsyncSemaphore(boost::asio::io_service& io_service_, int count_ = 0)
+        :io_service(io_service_), count(count_), life(std::make_shared<Life>(this)){}
+    AsyncSemaphore(const AsyncSemaphore&) = delete;
+    ~AsyncSemaphore()
+    {
+        {
+            std::lock_guard<std::mutex> guard(life->mtx);
+            life->self = nullptr; // timer handlers still queued find nothing to do
+        }
+        while (head) {
+            Op* op = head;
+            unlink(op);
+            op->run(this, op, boost::system::error_code(), false);
+        }
+        // nodes go with their timers, whatever references are left
+    }
+
+    template <typename Handler>
+    void async_wait(Handler&& handler)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (not head && count > 0) {
+            count--;
+            lock.unlock();
+            boost::asio::post(io_service, [handler = std::forward<Handler>(handler)]() mutable { handler(boost::system::error_code()); });
+            return;
+        }
+        Op* op = make_op(std::forward<Handler>(handler));
+        op->refs = 1;
+        enqueue(op);
+    }
+
+    template <typename Duration, typename Handler>
+    void async_wait(Duration timeout, Handler&& handler)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (not head && count > 0) {
+            count--;
+            lock.unlock();
+            boost::asio::post(io_service, [handler = std::forward<Handler>(handler)]() mutable { handler(boost::system::error_code()); });
+            return;
+        }
+        Op* op = make_op(std::forward<Handler>(handler));
+        op->refs = 2; // the timer handler holds the node too
+        if (not op->timer) op->timer.emplace(io_service);
+        op->timer->expires_after(std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+        op->timer->async_wait([life = life, op](const boost::system::error_code& ec) {
+            AsyncSemaphore* self;
+            {
+                std::lock_guard<std::mutex> guard(life->mtx);
+                self = life->self;
+            }
+            if (self) self->on_timer(op, ec);
+        });
+        enqueue(op);
+    }
+
+    bool try_wait()
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        if (head || count == 0) return false;
+        count--;
+        return true;
+    }
+
+    void release(int n = 1)
+    {
+        Op* ready = nullptr;
+        Op** last = &ready;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            count += n;
+            while (head && count > 0) {
+                Op* op = head;
+                count--;
+                unlink(op);
+                if (op->refs == 2) op->timer->cancel();
+                *last = op;
+                last = &op->next;
+            }
+        }
+        post_ready(ready, boost::system::error_code());
+    }
+    void notify() { release(1); }
+
+    void cancel()
+    {
+        Op* ready = nullptr;
+        Op** last = &ready;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            while (head) {
+                Op* op = head;
+                unlink(op);
+                if (op->refs == 2) op->timer->cancel();
+                *last = op;
+                last = &op->next;
+            }
+        }
+        post_ready(ready, boost::asio::error::operation_aborted);
+    }
+
+private:
+    struct Op
+    {
+        alignas(std::max_align_t) unsigned char storage[InlineHandler];
+        // moves the handler out and destroys it, releases the node, then calls the handler if invoke
+        void (*run)(AsyncSemaphore*, Op*, const boost::system::error_code&, bool invoke) = nullptr;
+        int refs = 0;
+        boost::optional<boost::asio::steady_timer> timer; // made once, kept with the node
+        bool queued = false; // in the wait queue; next also chains ready and free nodes
+        Op* prev = nullptr;
+        Op* next = nullptr;
+    };
+
+    boost::asio::io_service& io_service;
+    std::mutex mtx; // guards everything below, and the nodes' timers
+    int count;
+    Op* head = nullptr;
+    Op* tail = nullptr;
+    Op* free_ops = nullptr;
+    std::vector<std::unique_ptr<Op>> nodes; // every node made, freed with the semaphore
+
+    // outlives the semaphore in the handlers of its timers
+    struct Life
+    {
+        explicit Life(AsyncSemaphore* self_):self(self_){}
+        std::mutex mtx;
+        AsyncSemaphore* self;
+    };
+    std::shared_ptr<Life> life;
+
+    template <typename Handler>
+    Op* make_op(Handler&& handler)
+    {
+        using H = std::decay_t<Handler>;
+        Op* op = free_ops;
+        if (op) {
+            free_ops = op->next;
+        } else {
+            nodes.push_back(std::make_unique<Op>());
+            op = nodes.back().get();
+        }
+        op->prev = op->next = nullptr;
+        if constexpr (sizeof(H) <= InlineHandler && alignof(H) <= alignof(std::max_align_t)) {
+            new (op->storage) H(std::forward<Handler>(handler));
+            op->run = [](AsyncSemaphore* self, Op* op, const boost::system::error_code& ec, bool invoke) {
+                H* stored = std::launder(reinterpret_cast<H*>(op->storage));
+                H h(std::move(*stored));
+                stored->~H();
+                self->unref(op);
+                if (invoke) h(ec);
+            };
+        } else {
+            new (op->storage) H*(new H(std::forward<Handler>(handler)));
+            op->run = [](AsyncSemaphore* self, Op* op, const boost::system::error_code& ec, bool invoke) {
+                std::unique_ptr<H> h(*std::launder(reinterpret_cast<H**>(op->storage)));
+                self->unref(op);
+                if (invoke) (*h)(ec);
+            };
+        }
+        return op;
+    }
+
+    void unref(Op* op)
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        if (--op->refs == 0) {
+            op->next = free_ops;
+            free_ops = op;
+        }
+    }
+
+    void on_timer(Op* op, const boost::system::error_code& ec)
+    {
+        bool expired = false;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            if (not ec && op->queued) { // else release() or cancel() took it first
+                unlink(op);
+                expired = true;
+            }
+        }
+        if (expired) {
+            unref(op); // the timer's reference; the handler's goes in run()
+            op->run(this, op, boost::asio::error::timed_out, true);
+        } else {
+            unref(op);
+        }
+    }
+
+    void post_ready(Op* ready, boost::system::error_code ec)
+    {
+        while (ready) {
+            Op* op = ready;
+            ready = op->next;
+            boost::asio::post(io_service, [this, op, ec]() { op->run(this, op, ec, true); });
+        }
+    }
+
+    void enqueue(Op* op)
+    {
+        op->queued = true;
+        op->prev = tail;
+        op->next = nullptr;
+        if (tail) tail->next = op;
+        else head = op;
+        tail = op;
+    }
+
+    void unlink(Op* op)
+    {
+        if (op->prev) op->prev->next = op->next;
+        else head = op->next;
+        if (op->next) op->next->prev = op->prev;
+        else tail = op->prev;
+        op->prev = op->next = nullptr;
+        op->queued = false;
+    }
+};
+
+enum class IOMode
+{
+    handoff,     // operations run on io_service threads while the caller waits for them
+    inline_poll  // the socket is non-blocking, operations run on the calling thread with poll()
+};
+
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+/**
+ * What a Socket, or all the Sockets of a SyncBoostIO, have been doing, see Socket::snapshot().
+ * reads and writes count I/O operations: system calls in IOMode::inline_poll, asio
+ * operations in IOMode::handoff. Durations are in nanoseconds.
+ */
+struct SocketStats
+{
+    uint64_t bytes_in = 0, bytes_out = 0;
+    uint64_t reads = 0, writes = 0;
+    uint64_t timeouts = 0; // try_again from read and write, connection_aborted from connect
+    std::map<boost::system::error_code, uint64_t> errors; // other failures, by code
+    LogHistogram read_ns;    // each successful read(), waiting included
+    LogHistogram connect_ns; // each successful connect()
+};
+
+namespace detail
+{
+// relaxed counters, written by the owning Socket and added up into parent as well
+struct SocketMetrics
+{
+    std::atomic<uint64_t> bytes_in {0}, bytes_out {0}, reads {0}, writes {0}, timeouts {0};
+    LogHistogram read_ns, connect_ns;
+    mutable std::mutex mtx; // guards errors, only touched on failures
+    std::map<boost::system::error_code, uint64_t> errors;
+    std::shared_ptr<SocketMetrics> parent;
+
+    void received(size_t n)
+    {
+        for (SocketMetrics* m = this; m; m = m->parent.get()) {
+            m->bytes_in.fetch_add(n, std::memory_order_relaxed);
+            m->reads.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void sent(size_t n)
+    {
+        for (SocketMetrics* m = this; m; m = m->parent.get()) {
+            m->bytes_out.fetch_add(n, std::memory_order_relaxed);
+            m->writes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void read_took(uint64_t ns) { for (SocketMetrics* m = this; m; m = m->parent.get()) m->read_ns.record(ns); }
+    void connect_took(uint64_t ns) { for (SocketMetrics* m = this; m; m = m->parent.get()) m->connect_ns.record(ns); }
+    void failed(const boost::system::error_code& ec, bool timeout)
+    {
+        for (SocketMetrics* m = this; m; m = m->parent.get()) {
+            if (timeout) {
+                m->timeouts.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                std::lock_guard<std::mutex> guard(m->mtx);
+                m->errors[ec]++;
+            }
+        }
+    }
+
+    SocketStats snapshot() const
+    {
+        SocketStats s;
+        s.bytes_in = bytes_in.load(std::memory_order_relaxed);
+        s.bytes_out = bytes_out.load(std::memory_order_relaxed);
+        s.reads = reads.load(std::memory_order_relaxed);
+        s.writes = writes.load(std::memory_order_relaxed);
+        s.timeouts = timeouts.load(std::memory_order_relaxed);
+        s.read_ns = read_ns;
+        s.connect_ns = connect_ns;
+        std::lock_guard<std::mutex> guard(mtx);
+        s.errors = errors;
+        return s;
+    }
+};
+}
+
+// Socket changes layout with metrics: keep instrumented and plain translation units apart
+inline namespace socket_metrics
+{
+#endif
+
 /**
  * Class Socket:
  * A wrapper of sync boost socket. designed for ONE SOCKET PER THREAD!
  *
  * As you know, one socket per thread is very inefficient,
- * So this should not be used in high network IO programs.
+ * So this should not be used in high network IO programs: AsyncSocket is for those.
  *
  * It is useful when one socket per thread is acceptable.
  * For example, you have a server program where computing is heavy and IO is negligible.
  * Or you are just prototyping something.
+ *
+ * With IOMode::inline_poll, connect, read and write need no thread running io_service:
+ * they call recv/send directly and wait in poll() with the timeout, saving two thread
+ * switches per call. co_read/co_write still go through io_service.
+ *
+ * Define SCINART_CPPLIB_SOCKET_METRICS to count bytes, operations, timeouts and errors,
+ * and to time reads and connects, see snapshot(). Without it nothing is recorded.
  */
-class Socket
+class Socket : public detail::TypedStream<Socket>
 {
+    friend class detail::TypedStream<Socket>;
+    friend class SyncBoostIO;
+public:
     using sock_ptr = std::unique_ptr<boost::asio::ip::tcp::socket>;
+    using ReleaseHook = std::function<void(sock_ptr&, bool reusable)>; // see set_release_hook
+private:
     boost::asio::io_service & io_service;
     sock_ptr sock;
     boost::system::error_code ec;
     std::chrono::milliseconds ctimeout = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::seconds(1));
     std::chrono::milliseconds rtimeout = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::seconds(1));
-    // std::chrono::milliseconds wtimeout = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::seconds(1));
+    std::chrono::milliseconds wtimeout {0}; // 0: none
+    IOMode mode = IOMode::handoff;
+    std::vector<char> rbuf; // see set_read_buffer(); unread bytes are [rbegin, rend)
+    size_t rbegin = 0, rend = 0;
+    bool corked = false;
+    std::vector<char> wbuf; // see cork()
+    bool broken = false; // an operation failed, the stream may be mid-message
+    ReleaseHook on_release;
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+    std::unique_ptr<detail::SocketMetrics> metrics = std::make_unique<detail::SocketMetrics>();
+#endif
 public:
     Socket(boost::asio::io_service& io_service_):io_service(io_service_){}
     Socket(Socket&& rhs) = default;
     Socket& operator=(Socket&& rhs) = default;
+#if BOOST_VERSION >= 107000 // get_io_service() is gone since boost 1.70
+    Socket(sock_ptr&& ptr):io_service(static_cast<boost::asio::io_service&>(ptr->get_executor().context())), sock(std::move(ptr)){}
+#else
     Socket(sock_ptr&& ptr):io_service(ptr->get_io_service()), sock(std::move(ptr)){}
-    ~Socket(){ if(sock) sock->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec); }
+#endif
+    ~Socket()
+    {
+        if (sock && on_release)
+            on_release(sock, reusable());
+        if(sock) sock->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    }
+
+    /**
+     * hook(sock, reusable) runs when the Socket is destroyed, and may take sock from it:
+     * this is how a ConnectionPool gets its connections back. reusable is false after a
+     * failed operation, or with bytes left in the read or write buffer.
+     */
+    void set_release_hook(ReleaseHook hook){on_release = std::move(hook);}
+    bool reusable() const { return sock && sock->is_open() && not broken && rbegin == rend && wbuf.empty(); }
+    // for protocol code giving up mid-message, e.g. on a refused frame: never reusable from now on
+    void set_broken() { broken = true; }
     void connect(std::string ip, int port)
     {
         using namespace boost::asio::ip;
-        sock = std::make_unique<tcp::socket>(io_service);
         tcp::resolver resolver(io_service);
         tcp::resolver::query query(tcp::v4(), ip, std::to_string(port));
-        tcp::resolver::iterator iterator = resolver.resolve(query);
-        Semaphore r_sem;
-        boost::system::error_code r_ec;
-        boost::asio::async_connect(*sock, iterator,
-                                   [this, &r_ec, &r_sem](const boost::system::error_code& ec_, tcp::resolver::iterator iter) {
-                                       (void)iter;
-                                       r_ec=ec_;
-                                       r_sem.notify();
-                                });
-        if(!r_sem.wait_for(ctimeout))
-        {
-            // http://www.boost.org/doc/libs/1_66_0/doc/html/boost_asio/reference/basic_socket/cancel/overload1.html
-            sock->close(); // Use the close() function to simultaneously cancel the outstanding operations and close the socket.
-            r_sem.wait(); // The handlers for cancelled operations will be passed the boost::asio::error::operation_aborted error.
-            throw boost::system::system_error(boost::asio::error::connection_aborted);
+        std::vector<tcp::endpoint> endpoints;
+        for (tcp::resolver::iterator iterator = resolver.resolve(query); iterator != tcp::resolver::iterator(); ++iterator)
+            endpoints.push_back(iterator->endpoint());
+        connect(endpoints);
+    }
+    // the first of endpoints accepting the connection
+    void connect(const std::vector<boost::asio::ip::tcp::endpoint>& endpoints)
+    {
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+        auto t0 = std::chrono::steady_clock::now();
+        try {
+            connect_(endpoints);
+        } catch (boost::system::system_error& e) {
+            metrics->failed(e.code(), e.code() == boost::asio::error::connection_aborted);
+            throw;
         }
-        else if(r_ec)
-            throw boost::system::system_error(r_ec);
+        metrics->connect_took(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+#else
+        connect_(endpoints);
+#endif
     }
     void set_socket(sock_ptr&& ptr){sock = std::move(ptr);}
+    void set_io_mode(IOMode mode_){mode = mode_;}
+    IOMode get_io_mode() const {return mode;}
+
+    /**
+     * Serve reads from a receive buffer of bytes bytes, 0 to turn it off (the default).
+     * The buffer is refilled with one read_some of as much as fits, so a run of small
+     * typed reads costs one system call; reads at least as large as the buffer go straight
+     * to their destination. co_read does not see the buffer: don't mix them.
+     *
+     * It is linear rather than a ring: the unread bytes are moved to its front before each
+     * refill, so that they, and whatever peek() returns, are always contiguous.
+     * Usually few bytes remain, so the move is cheap.
+     */
+    void set_read_buffer(size_t bytes)
+    {
+        if (rend != rbegin)
+            throw std::logic_error("Socket: read buffer still holds data");
+        rbuf.assign(bytes, 0);
+        rbegin = rend = 0;
+    }
+    size_t buffered() const { return rend - rbegin; }
+
+    /**
+     * The next n received bytes, without consuming them; valid until the next read.
+     * Needs a read buffer of at least n bytes.
+     */
+    std::string_view peek(size_t n)
+    {
+        if (n > rbuf.size())
+            throw std::invalid_argument("Socket::peek: more than the read buffer holds");
+        auto deadline = std::chrono::steady_clock::now() + rtimeout;
+        try {
+            while (rend - rbegin < n)
+                fill(deadline);
+        } catch (...) {
+            mark_broken();
+            throw;
+        }
+        return std::string_view(rbuf.data() + rbegin, n);
+    }
+    // drop n bytes already seen through peek()
+    void consume(size_t n)
+    {
+        if (n > rend - rbegin)
+            throw std::invalid_argument("Socket::consume: more than is buffered");
+        rbegin += n;
+    }
     sock_ptr& get_sock_ptr(){return sock;}
     template<typename Duration> void set_read_timeout (Duration d){rtimeout = std::chrono::duration_cast<decltype(rtimeout)>(d);}
     template<typename Duration> void set_connection_timeout (Duration d){ctimeout = std::chrono::duration_cast<decltype(ctimeout)>(d);}
-    // template<typename Duration> void set_write_timeout(Duration d){wtimeout = std::chrono::duration_cast<decltype(wtimeout)>(d);}
+    // a write not done in time throws try_again, like read. 0, the default, waits forever.
+    template<typename Duration> void set_write_timeout(Duration d){wtimeout = std::chrono::duration_cast<decltype(wtimeout)>(d);}
 
-    template<typename Container> std::enable_if_t<is_container<std::remove_reference_t<Container>>::value, void> write (Container&& t) { return write(t, t.size()); }
-    template<typename Container> std::enable_if_t<is_container<std::remove_reference_t<Container>>::value, void> write (Container&& t, size_t sz) {
-        auto buffer = boost::asio::buffer(t, sz * sizeof(typename std::remove_reference_t<Container>::value_type));
-        write_(*sock, buffer);
+    /**
+     * While corked, writes only append to a send buffer; flush() sends it with one call.
+     * uncork() flushes and goes back to sending each write. Flush before destroying the Socket.
+     */
+    void cork() { corked = true; }
+    void flush()
+    {
+        if (wbuf.empty()) return;
+        boost::asio::const_buffer b(wbuf.data(), wbuf.size());
+        bool was_corked = corked;
+        corked = false;
+        try {
+            write_buffers(&b, 1);
+        } catch (...) {
+            corked = was_corked;
+            wbuf.clear();
+            throw;
+        }
+        corked = was_corked;
+        wbuf.clear();
     }
+    void uncork() { flush(); corked = false; }
+    size_t unflushed() const { return wbuf.size(); }
 
-    template<typename T> std::enable_if_t<!is_container<T>::value, void> write (const T& t) { return write(&t, 1); }
-    template<typename T> std::enable_if_t<!is_container<T>::value, void> write (T* p, size_t nmemb) {
-        auto buffer = boost::asio::buffer(p, nmemb * sizeof(T));
-        write_(*sock, buffer);
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+    SocketStats snapshot() const { return metrics->snapshot(); }
+#endif
+
+#ifdef __linux__
+    static constexpr uint64_t to_end = UINT64_MAX;
+
+    /**
+     * Send len bytes of the open file fd, from offset, with sendfile(): the kernel moves them
+     * from the page cache to the socket without copying them through user space.
+     * len = to_end sends the rest of the file. progress(sent so far) is called after every
+     * chunk of at most 1 MiB. Unflushed corked bytes go first. Like write(), the whole
+     * transfer throws try_again if not done within the write timeout; a file shorter than
+     * offset + len throws eof.
+     */
+    void send_file(int fd, uint64_t offset = 0, uint64_t len = to_end, const std::function<void(uint64_t)>& progress = nullptr)
+    {
+        flush();
+        if (len == to_end) {
+            struct stat st;
+            if (::fstat(fd, &st) != 0) throw_errno();
+            len = uint64_t(st.st_size) > offset ? uint64_t(st.st_size) - offset : 0;
+        }
+        auto deadline = wtimeout.count() ? std::chrono::steady_clock::now() + wtimeout : std::chrono::steady_clock::time_point::max();
+        NonBlocking guard(*sock);
+        try {
+            for (uint64_t sent = 0; sent < len; ) {
+                off_t pos = off_t(offset + sent);
+                ssize_t n = ::sendfile(sock->native_handle(), fd, &pos, std::min<uint64_t>(len - sent, file_chunk));
+                if (n > 0) {
+                    count_out(n);
+                    sent += n;
+                    if (progress) progress(sent);
+                    continue;
+                }
+                if (n == 0)
+                    throw boost::system::system_error(boost::asio::error::eof);
+                wait_or_throw(POLLOUT, deadline);
+            }
+        } catch (...) {
+            mark_broken();
+            throw;
+        }
+    }
+    void send_file(const std::string& path, uint64_t offset = 0, uint64_t len = to_end, const std::function<void(uint64_t)>& progress = nullptr)
+    {
+        FileDescriptor file(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        send_file(file.fd, offset, len, progress);
     }
 
-    template<typename T> T read () {
-        T t;
-        read(t);
-        return t;
+    /**
+     * Receive len bytes into the open file fd, at offset, with splice(): from the socket
+     * into a pipe, and from the pipe into the file, without copying them through user space.
+     * Bytes already in the read buffer are written first. progress(received so far) is called
+     * after every chunk. Like read(), the whole transfer throws try_again if not done within
+     * the read timeout, and eof if the peer closes first.
+     */
+    void receive_to_file(int fd, uint64_t offset, uint64_t len, const std::function<void(uint64_t)>& progress = nullptr)
+    {
+        auto deadline = std::chrono::steady_clock::now() + rtimeout;
+        try {
+            uint64_t received = 0;
+            while (rbegin != rend && received < len) {
+                ssize_t n = ::pwrite(fd, rbuf.data() + rbegin, std::min<uint64_t>(rend - rbegin, len - received), off_t(offset + received));
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) throw_errno();
+                if (n == 0) throw_file_full();
+                rbegin += n;
+                received += n;
+            }
+            if (received && progress) progress(received);
+            if (received == len) return;
+
+            int p[2];
+            if (::pipe2(p, O_CLOEXEC) != 0) throw_errno();
+            FileDescriptor out(p[0]), in(p[1]);
+            ::fcntl(in.fd, F_SETPIPE_SZ, int(file_chunk)); // a bigger pipe means fewer rounds; fine if refused
+            NonBlocking guard(*sock);
+            while (received < len) {
+                ssize_t n = ::splice(sock->native_handle(), nullptr, in.fd, nullptr, std::min<uint64_t>(len - received, file_chunk), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n == 0)
+                    throw boost::system::system_error(boost::asio::error::eof);
+                if (n < 0) {
+                    wait_or_throw(POLLIN, deadline);
+                    continue;
+                }
+                count_in(n);
+                for (ssize_t left = n; left; ) {
+                    loff_t pos = loff_t(offset + received);
+                    ssize_t m = ::splice(out.fd, nullptr, fd, &pos, left, SPLICE_F_MOVE);
+                    if (m < 0 && errno == EINTR) continue;
+                    if (m < 0) throw_errno();
+                    if (m == 0) throw_file_full();
+                    left -= m;
+                    received += m;
+                }
+                if (progress) progress(received);
+            }
+        } catch (...) {
+            mark_broken();
+            throw;
+        }
     }
+    // the file is created if missing; its bytes outside [offset, offset + len) are kept
+    void receive_to_file(const std::string& path, uint64_t offset, uint64_t len, const std::function<void(uint64_t)>& progress = nullptr)
+    {
+        FileDescriptor file(::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+        receive_to_file(file.fd, offset, len, progress);
+    }
+#endif
 
-    template<typename T> std::vector<T> read (size_t n) {
-        std::vector<T> v(n);
-        read(v);
-        return v;
+#if __cpp_impl_coroutine >= 201902L
+    /**
+     * co_await-able counterparts of read() and write(): the coroutine holds no thread while
+     * the operation is in flight, and resumes on a thread running io_service.
+     * co_read throws try_again after the read timeout, like read().
+     */
+    template<typename T> auto co_read (T& t) { return co_read_(detail::as_buffer(t)); }
+    template<typename T> auto co_write (const T& t) { return co_write_(detail::as_buffer(t)); }
+#endif
+
+private:
+#if __cpp_impl_coroutine >= 201902L
+    auto co_read_(boost::asio::mutable_buffer buffer)
+    {
+        auto* s = sock.get();
+        auto initiate = [s, buffer](auto handler) { boost::asio::async_read(*s, buffer, std::move(handler)); };
+        return detail::AsioAwaiter<decltype(initiate)>(initiate, *sock, rtimeout);
+    }
+    auto co_write_(boost::asio::const_buffer buffer)
+    {
+        auto* s = sock.get();
+        auto initiate = [s, buffer](auto handler) { boost::asio::async_write(*s, buffer, std::move(handler)); };
+        return detail::AsioAwaiter<decltype(initiate)>(initiate, *sock, std::chrono::milliseconds(0));
     }
+#endif
 
-    template<typename Container> std::enable_if_t<is_container<std::remove_reference_t<Container>>::value, void> read (Container& t) { return read(t, t.size()); }
-    template<typename Container> std::enable_if_t<is_container<std::remove_reference_t<Container>>::value, void> read (Container& t, size_t sz) {
-        auto buffer = boost::asio::buffer(t, sz * sizeof(typename std::remove_reference_t<Container>::value_type));
-        read_(*sock, buffer);
+    // in a catch block: the stream may be mid-message now
+    void mark_broken()
+    {
+        broken = true;
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+        try {
+            throw;
+        } catch (boost::system::system_error& e) {
+            metrics->failed(e.code(), e.code() == boost::asio::error::try_again);
+        } catch (...) {
+        }
+#endif
+    }
+    void count_in(size_t n)
+    {
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+        metrics->received(n);
+#else
+        (void)n;
+#endif
+    }
+    void count_out(size_t n)
+    {
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+        metrics->sent(n);
+#else
+        (void)n;
+#endif
     }
 
-    template<typename T> std::enable_if_t<!is_container<T>::value, void> read (T& t) { return read(&t, 1); }
-    template<typename T> std::enable_if_t<!is_container<T>::value, void> read (T* p, size_t nmemb) {
-        auto buffer = boost::asio::buffer(p, nmemb * sizeof(T));
-        read_(*sock, buffer);
+    void connect_(const std::vector<boost::asio::ip::tcp::endpoint>& endpoints)
+    {
+        using namespace boost::asio::ip;
+        sock = std::make_unique<tcp::socket>(io_service);
+        broken = false;
+        if (mode == IOMode::inline_poll)
+            return connect_inline(endpoints);
+        LightSemaphore r_sem;
+        boost::system::error_code r_ec;
+        boost::asio::async_connect(*sock, endpoints,
+                                   [this, &r_ec, &r_sem](const boost::system::error_code& ec_, const tcp::endpoint&) {
+                                       r_ec=ec_;
+                                       r_sem.notify();
+                                });
+        if(!r_sem.wait_for(ctimeout))
+        {
+            // http://www.boost.org/doc/libs/1_66_0/doc/html/boost_asio/reference/basic_socket/cancel/overload1.html
+            sock->close(); // Use the close() function to simultaneously cancel the outstanding operations and close the socket.
+            r_sem.wait(); // The handlers for cancelled operations will be passed the boost::asio::error::operation_aborted error.
+            throw boost::system::system_error(boost::asio::error::connection_aborted);
+        }
+        else if(r_ec)
+            throw boost::system::system_error(r_ec);
     }
 
-private:
+    void read_buffer(boost::asio::mutable_buffer buffer)
+    {
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+        auto t0 = std::chrono::steady_clock::now();
+#endif
+        try {
+            read_unguarded(*sock, buffer);
+        } catch (...) {
+            mark_broken();
+            throw;
+        }
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+        metrics->read_took(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+#endif
+    }
     template <typename SyncStream, typename MutableBufferSequence>
-    void read_(SyncStream& s, const MutableBufferSequence& buffer)
+    void read_unguarded(SyncStream& s, const MutableBufferSequence& buffer)
     {
-        Semaphore r_sem;
+        if (not rbuf.empty())
+            return read_buffered(buffer);
+        if (mode == IOMode::inline_poll)
+            return read_inline(buffer);
+        LightSemaphore r_sem;
         boost::system::error_code r_ec;
         boost::asio::async_read(s,buffer,
                                 [this, &r_ec, &r_sem](const boost::system::error_code& ec_, size_t) {
@@ -132,11 +1026,514 @@ private:
         }
         else if(r_ec)
             throw boost::system::system_error(r_ec);
+        count_in(boost::asio::buffer_size(buffer));
     }
-    template <typename SyncStream, typename MutableBufferSequence>
-    void write_(SyncStream& s, const MutableBufferSequence& buffer)
+    // bufs[0, count) as a buffer sequence for asio
+    struct BufferRange
+    {
+        const boost::asio::const_buffer* b;
+        const boost::asio::const_buffer* e;
+        const boost::asio::const_buffer* begin() const { return b; }
+        const boost::asio::const_buffer* end() const { return e; }
+    };
+
+    void write_buffers(const boost::asio::const_buffer* bufs, size_t count)
+    {
+        try {
+            write_unguarded(bufs, count);
+        } catch (...) {
+            mark_broken();
+            throw;
+        }
+    }
+    void write_unguarded(const boost::asio::const_buffer* bufs, size_t count)
+    {
+        if (corked) {
+            for (size_t i = 0; i < count; i++) {
+                auto p = static_cast<const char*>(bufs[i].data());
+                wbuf.insert(wbuf.end(), p, p + bufs[i].size());
+            }
+            return;
+        }
+        if (mode == IOMode::inline_poll)
+            return write_inline(bufs, count);
+        BufferRange range{bufs, bufs + count};
+        if (wtimeout.count() == 0) {
+            count_out(boost::asio::write(*sock, range));
+            return;
+        }
+        LightSemaphore w_sem;
+        boost::system::error_code w_ec;
+        boost::asio::async_write(*sock, range, [&w_ec, &w_sem](const boost::system::error_code& ec_, size_t) {
+            w_ec = ec_;
+            w_sem.notify();
+        });
+        if (not w_sem.wait_for(wtimeout)) {
+            sock->cancel();
+            w_sem.wait();
+            throw boost::system::system_error(boost::asio::error::try_again);
+        }
+        if (w_ec)
+            throw boost::system::system_error(w_ec);
+        count_out(boost::asio::buffer_size(range));
+    }
+
+#ifdef __linux__
+    static constexpr uint64_t file_chunk = 1 << 20;
+
+    [[noreturn]] static void throw_errno()
+    {
+        throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+    }
+    // a write into the file took nothing, which sets no errno
+    [[noreturn]] static void throw_file_full()
+    {
+        throw boost::system::system_error(boost::system::errc::make_error_code(boost::system::errc::no_space_on_device));
+    }
+
+    // closes fd; throws if it is not valid
+    struct FileDescriptor
+    {
+        int fd;
+        explicit FileDescriptor(int fd_):fd(fd_) { if (fd < 0) throw_errno(); }
+        FileDescriptor(const FileDescriptor&) = delete;
+        ~FileDescriptor() { ::close(fd); }
+    };
+
+    // the socket in non-blocking mode while it lives, so that the raw system calls can time out
+    struct NonBlocking
+    {
+        boost::asio::ip::tcp::socket& sock;
+        bool was;
+        explicit NonBlocking(boost::asio::ip::tcp::socket& sock_):sock(sock_), was(sock_.non_blocking()) { if (not was) sock.non_blocking(true); }
+        NonBlocking(const NonBlocking&) = delete;
+        ~NonBlocking() { boost::system::error_code ignored; if (not was) sock.non_blocking(false, ignored); }
+    };
+
+    // after a failed raw call on the socket: wait for it to become ready, or throw
+    void wait_or_throw(short events, std::chrono::steady_clock::time_point deadline)
+    {
+        if (errno == EINTR) return;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) throw_errno();
+        if (not poll_ready(events, deadline))
+            throw boost::system::system_error(boost::asio::error::try_again);
+    }
+#endif
+
+    // inline_poll mode: wait in poll() until the socket is ready for events, false once deadline passed.
+    bool poll_ready(short events, std::chrono::steady_clock::time_point deadline)
+    {
+        return detail::poll_ready(sock->native_handle(), events, deadline);
+    }
+
+    void read_inline(boost::asio::mutable_buffer buffer)
+    {
+        auto deadline = std::chrono::steady_clock::now() + rtimeout;
+        while (buffer.size())
+            buffer += read_some_(buffer, deadline);
+    }
+
+    // at least one byte, at most buffer.size(); throw try_again after deadline.
+    size_t read_some_(boost::asio::mutable_buffer buffer, std::chrono::steady_clock::time_point deadline)
+    {
+        if (mode == IOMode::inline_poll) {
+            if (not sock->non_blocking()) sock->non_blocking(true);
+            size_t n = detail::recv_some(sock->native_handle(), buffer, deadline);
+            count_in(n);
+            return n;
+        }
+        LightSemaphore r_sem;
+        boost::system::error_code r_ec;
+        size_t r_n = 0;
+        sock->async_read_some(boost::asio::buffer(buffer), [&r_ec, &r_n, &r_sem](const boost::system::error_code& ec_, size_t n_) {
+            r_ec = ec_;
+            r_n = n_;
+            r_sem.notify();
+        });
+        if (not r_sem.wait_for(deadline - std::chrono::steady_clock::now())) {
+            sock->cancel();
+            r_sem.wait();
+            if (r_n == 0) // otherwise the data came in right before cancel()
+                throw boost::system::system_error(boost::asio::error::try_again);
+        } else if (r_ec) {
+            throw boost::system::system_error(r_ec);
+        }
+        count_in(r_n);
+        return r_n;
+    }
+
+    void read_buffered(boost::asio::mutable_buffer buffer)
+    {
+        auto deadline = std::chrono::steady_clock::now() + rtimeout;
+        while (true) {
+            size_t n = std::min(buffer.size(), rend - rbegin);
+            std::memcpy(buffer.data(), rbuf.data() + rbegin, n);
+            rbegin += n;
+            buffer += n;
+            if (buffer.size() == 0) return;
+            if (buffer.size() >= rbuf.size())
+                buffer += read_some_(buffer, deadline); // large reads skip the extra copy
+            else
+                fill(deadline);
+        }
+    }
+
+    // one read_some into the free end of the receive buffer, after moving what is left to its front
+    void fill(std::chrono::steady_clock::time_point deadline)
+    {
+        if (rbegin == rend) {
+            rbegin = rend = 0;
+        } else if (rbegin > 0) {
+            std::memmove(rbuf.data(), rbuf.data() + rbegin, rend - rbegin);
+            rend -= rbegin;
+            rbegin = 0;
+        }
+        rend += read_some_(boost::asio::buffer(rbuf.data() + rend, rbuf.size() - rend), deadline);
+    }
+
+    void write_inline(const boost::asio::const_buffer* bufs, size_t count)
+    {
+        if (not sock->non_blocking()) sock->non_blocking(true);
+        auto deadline = wtimeout.count() ? std::chrono::steady_clock::now() + wtimeout : std::chrono::steady_clock::time_point::max();
+        detail::send_all(sock->native_handle(), bufs, count, deadline);
+        count_out(boost::asio::buffer_size(BufferRange{bufs, bufs + count}));
+    }
+
+    void connect_inline(const std::vector<boost::asio::ip::tcp::endpoint>& endpoints)
+    {
+        auto deadline = std::chrono::steady_clock::now() + ctimeout;
+        boost::system::error_code c_ec = boost::asio::error::host_not_found;
+        for (auto& endpoint : endpoints) {
+            boost::system::error_code ignored;
+            sock->close(ignored);
+            sock->open(endpoint.protocol());
+            sock->non_blocking(true);
+            sock->connect(endpoint, c_ec);
+            if (c_ec == boost::asio::error::in_progress || c_ec == boost::asio::error::would_block) {
+                if (not poll_ready(POLLOUT, deadline)) {
+                    sock->close(ignored);
+                    throw boost::system::system_error(boost::asio::error::connection_aborted);
+                }
+                int err = 0;
+                socklen_t len = sizeof(err);
+                ::getsockopt(sock->native_handle(), SOL_SOCKET, SO_ERROR, &err, &len);
+                c_ec = boost::system::error_code(err, boost::system::system_category());
+            }
+            if (not c_ec) return;
+        }
+        throw boost::system::system_error(c_ec);
+    }
+};
+
+/**
+ * Class AsyncSocket:
+ * The asynchronous counterpart of Socket, for many connections served by a few threads
+ * running one io_service.
+ *
+ * async_read/async_write take the same objects and containers as Socket's read/write, and
+ * call handler(error_code) when done; the object must live until then. At most one read and
+ * one write may be in flight at a time. With a timeout set, an operation not done in time
+ * fails with try_again, like Socket::read.
+ *
+ * All operations and handlers run on the socket's strand, so any thread may start them, and
+ * handlers of one connection never run concurrently with each other.
+ */
+class AsyncSocket
+{
+    using tcp = boost::asio::ip::tcp;
+    using sock_ptr = std::unique_ptr<tcp::socket>;
+    using Handler = std::function<void(const boost::system::error_code&)>;
+public:
+    explicit AsyncSocket(boost::asio::io_service& io_service_)
+        :io_service(io_service_), strand(io_service_), sock(std::make_unique<tcp::socket>(io_service_)),
+         reading(io_service_), writing(io_service_){}
+    AsyncSocket(boost::asio::io_service& io_service_, sock_ptr&& ptr)
+        :io_service(io_service_), strand(io_service_), sock(std::move(ptr)),
+         reading(io_service_), writing(io_service_){}
+    AsyncSocket(const AsyncSocket&) = delete;
+    ~AsyncSocket(){ boost::system::error_code ec; if(sock) sock->shutdown(tcp::socket::shutdown_both, ec); }
+
+    template<typename Duration> void set_read_timeout (Duration d){reading.timeout = std::chrono::duration_cast<std::chrono::milliseconds>(d);}
+    template<typename Duration> void set_write_timeout (Duration d){writing.timeout = std::chrono::duration_cast<std::chrono::milliseconds>(d);}
+    sock_ptr& get_sock_ptr(){return sock;}
+    boost::asio::io_service::strand& get_strand(){return strand;}
+
+    void async_connect(const std::string& ip, int port, Handler handler)
+    {
+        auto resolver = std::make_shared<tcp::resolver>(io_service);
+        resolver->async_resolve(tcp::v4(), ip, std::to_string(port), boost::asio::bind_executor(strand,
+            [this, resolver, handler = std::move(handler)](const boost::system::error_code& ec, tcp::resolver::results_type results) mutable {
+                if (ec) return handler(ec);
+                boost::asio::async_connect(*sock, results, boost::asio::bind_executor(strand,
+                    [handler = std::move(handler)](const boost::system::error_code& ec_, const tcp::endpoint&) { handler(ec_); }));
+            }));
+    }
+
+    template<typename T> void async_read (T& t, Handler handler) { start(detail::as_buffer(t), reading, std::move(handler)); }
+    template<typename T> void async_write (const T& t, Handler handler) { start(detail::as_buffer(t), writing, std::move(handler)); }
+
+    // handler(error_code, T)
+    template<typename T, typename ValueHandler> void async_read (ValueHandler handler)
     {
-        boost::asio::write(s, buffer);
+        auto t = std::make_shared<T>();
+        T& ref = *t;
+        async_read(ref, [t, handler = std::move(handler)](const boost::system::error_code& ec) mutable {
+            handler(ec, std::move(*t));
+        });
+    }
+
+#if __cpp_impl_coroutine >= 201902L
+    // co_await-able forms, throwing where the handler would get an error.
+    template<typename T> auto co_read (T& t) { return co_op(detail::as_buffer(t), reading.timeout); }
+    template<typename T> auto co_write (const T& t) { return co_op(detail::as_buffer(t), writing.timeout); }
+#endif
+
+private:
+    // the state of the one read, or the one write, in flight
+    struct Direction
+    {
+        explicit Direction(boost::asio::io_service& io_service_):timer(io_service_){}
+        boost::asio::steady_timer timer;
+        std::chrono::milliseconds timeout {0}; // 0: none
+        bool expired = false;
+    };
+
+    boost::asio::io_service& io_service;
+    boost::asio::io_service::strand strand;
+    sock_ptr sock;
+    Direction reading, writing;
+
+    template <typename Buffer>
+    static constexpr bool is_read = std::is_convertible<Buffer, boost::asio::mutable_buffer>::value;
+
+    template <typename Buffer, typename CompletionHandler>
+    void initiate(Buffer buffer, CompletionHandler&& done)
+    {
+        if constexpr (is_read<Buffer>)
+            boost::asio::async_read(*sock, buffer, boost::asio::bind_executor(strand, std::forward<CompletionHandler>(done)));
+        else
+            boost::asio::async_write(*sock, buffer, boost::asio::bind_executor(strand, std::forward<CompletionHandler>(done)));
+    }
+
+    template <typename Buffer>
+    void start(Buffer buffer, Direction& dir, Handler handler)
+    {
+        boost::asio::dispatch(strand, [this, buffer, &dir, handler = std::move(handler)]() mutable {
+            dir.expired = false;
+            bool timed = dir.timeout.count() > 0;
+            if (timed) {
+                dir.timer.expires_after(dir.timeout);
+                dir.timer.async_wait(boost::asio::bind_executor(strand, [this, &dir](const boost::system::error_code& ec) {
+                    // a wait for an earlier operation may complete late: check the deadline is still ours
+                    if (ec || dir.timer.expiry() > std::chrono::steady_clock::now()) return;
+                    dir.expired = true;
+                    boost::system::error_code ignored;
+                    sock->cancel(ignored);
+                }));
+            }
+            initiate(buffer, [&dir, timed, handler = std::move(handler)](const boost::system::error_code& ec, size_t) {
+                if (timed) dir.timer.cancel();
+                if (dir.expired && ec == boost::asio::error::operation_aborted)
+                    handler(boost::asio::error::try_again);
+                else
+                    handler(ec);
+            });
+        });
+    }
+
+#if __cpp_impl_coroutine >= 201902L
+    template <typename Buffer>
+    auto co_op(Buffer buffer, std::chrono::milliseconds timeout)
+    {
+        auto start_op = [this, buffer](auto handler) {
+            boost::asio::dispatch(strand, [this, buffer, handler = std::move(handler)]() mutable {
+                initiate(buffer, std::move(handler));
+            });
+        };
+        return detail::AsioAwaiter<decltype(start_op), boost::asio::io_service::strand>(start_op, *sock, strand, timeout);
+    }
+#endif
+};
+
+/**
+ * Class ConnectionPool:
+ * Keeps connections to (host, port) open after use, for the next get() to the same place.
+ *
+ *   ConnectionPool pool(io_service);
+ *   {
+ *       Socket s = pool.get("backend", 8080);
+ *       ...
+ *   } // back to the pool, unless an operation on it failed
+ *
+ * get() takes the most recently returned idle connection, after checking that the peer
+ * has neither closed it nor sent anything unasked; otherwise it connects. At most
+ * max_per_host connections to a place exist at once, idle or not: get() waits up to
+ * checkout_timeout for one to come back, then throws timed_out.
+ * Resolved addresses are cached for dns_ttl.
+ *
+ * Thread safe. Sockets may outlive the pool; they are then just closed.
+ */
+class ConnectionPool
+{
+    using tcp = boost::asio::ip::tcp;
+    using sock_ptr = Socket::sock_ptr;
+    using ReleaseHook = Socket::ReleaseHook;
+public:
+    struct Limits
+    {
+        size_t max_idle_per_host = 8;
+        size_t max_per_host = 64;
+        std::chrono::milliseconds idle_timeout = std::chrono::seconds(60);
+        std::chrono::milliseconds checkout_timeout = std::chrono::seconds(1);
+        std::chrono::milliseconds dns_ttl = std::chrono::seconds(30);
+    };
+
+    explicit ConnectionPool(boost::asio::io_service& io_service_):ConnectionPool(io_service_, Limits()){}
+    ConnectionPool(boost::asio::io_service& io_service_, Limits limits_)
+        :io_service(io_service_), state(std::make_shared<State>(limits_)){}
+    ConnectionPool(const ConnectionPool&) = delete;
+
+    Socket get(const std::string& host, int port, IOMode mode = IOMode::handoff)
+    {
+        std::string key = host + ":" + std::to_string(port);
+        auto deadline = std::chrono::steady_clock::now() + state->limits.checkout_timeout;
+        std::unique_lock<std::mutex> lock(state->mtx);
+        Place& place = state->places[key];
+        while (true) {
+            while (not place.idle.empty()) {
+                Idle idle = std::move(place.idle.back());
+                place.idle.pop_back();
+                if (std::chrono::steady_clock::now() - idle.since < state->limits.idle_timeout && healthy(*idle.sock)) {
+                    Socket s(std::move(idle.sock));
+                    s.set_io_mode(mode);
+                    s.set_release_hook(hook(key));
+                    return s;
+                }
+                boost::system::error_code ignored;
+                idle.sock->close(ignored);
+                place.live--;
+            }
+            if (place.live < state->limits.max_per_host)
+                break;
+            if (state->cv.wait_until(lock, deadline) == std::cv_status::timeout && place.idle.empty() && place.live >= state->limits.max_per_host)
+                throw boost::system::system_error(boost::asio::error::timed_out);
+        }
+        place.live++;
+        lock.unlock();
+
+        try {
+            Socket s(io_service);
+            s.set_io_mode(mode);
+            s.connect(resolve(host, port));
+            s.set_release_hook(hook(key));
+            return s;
+        } catch (...) {
+            lock.lock();
+            place.live--;
+            state->cv.notify_one();
+            throw;
+        }
+    }
+
+    // connections to host:port, idle or in use
+    size_t live(const std::string& host, int port) const
+    {
+        std::lock_guard<std::mutex> guard(state->mtx);
+        auto it = state->places.find(host + ":" + std::to_string(port));
+        return it == state->places.end() ? 0 : it->second.live;
+    }
+    size_t idle(const std::string& host, int port) const
+    {
+        std::lock_guard<std::mutex> guard(state->mtx);
+        auto it = state->places.find(host + ":" + std::to_string(port));
+        return it == state->places.end() ? 0 : it->second.idle.size();
+    }
+
+    void clear_dns_cache()
+    {
+        std::lock_guard<std::mutex> guard(state->mtx);
+        state->dns.clear();
+    }
+
+private:
+    struct Idle
+    {
+        sock_ptr sock;
+        std::chrono::steady_clock::time_point since;
+    };
+    struct Place
+    {
+        size_t live = 0;
+        std::deque<Idle> idle; // most recently returned at the back
+    };
+    struct Resolved
+    {
+        std::vector<tcp::endpoint> endpoints;
+        std::chrono::steady_clock::time_point expiry;
+    };
+    // shared with the release hooks of the sockets handed out
+    struct State
+    {
+        explicit State(Limits limits_):limits(limits_){}
+        const Limits limits;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::unordered_map<std::string, Place> places; // by "host:port"
+        std::unordered_map<std::string, Resolved> dns;
+    };
+
+    boost::asio::io_service& io_service;
+    std::shared_ptr<State> state;
+
+    // an idle connection is readable only if the peer closed it or sent something unasked
+    static bool healthy(tcp::socket& sock)
+    {
+        if (not sock.is_open()) return false;
+        pollfd p{sock.native_handle(), POLLIN, 0};
+        return ::poll(&p, 1, 0) == 0;
+    }
+
+    ReleaseHook hook(const std::string& key) { return release_hook(state, key); }
+    static ReleaseHook release_hook(const std::shared_ptr<State>& state, std::string key)
+    {
+        std::weak_ptr<State> weak = state;
+        return [weak, key](sock_ptr& sock, bool reusable) {
+            auto state = weak.lock();
+            if (not state) return;
+            boost::system::error_code ignored;
+            std::lock_guard<std::mutex> guard(state->mtx);
+            Place& place = state->places[key];
+            if (reusable && place.idle.size() < state->limits.max_idle_per_host) {
+                sock->non_blocking(false, ignored); // the next user may not be in inline_poll mode
+                place.idle.push_back(Idle{std::move(sock), std::chrono::steady_clock::now()});
+            } else {
+                sock->shutdown(tcp::socket::shutdown_both, ignored);
+                sock->close(ignored);
+                sock.reset();
+                place.live--;
+            }
+            state->cv.notify_one();
+        };
+    }
+
+    std::vector<tcp::endpoint> resolve(const std::string& host, int port)
+    {
+        std::string key = host + ":" + std::to_string(port);
+        {
+            std::lock_guard<std::mutex> guard(state->mtx);
+            auto it = state->dns.find(key);
+            if (it != state->dns.end() && std::chrono::steady_clock::now() < it->second.expiry)
+                return it->second.endpoints;
+        }
+        tcp::resolver resolver(io_service);
+        tcp::resolver::query query(tcp::v4(), host, std::to_string(port));
+        Resolved r;
+        for (tcp::resolver::iterator it = resolver.resolve(query); it != tcp::resolver::iterator(); ++it)
+            r.endpoints.push_back(it->endpoint());
+        r.expiry = std::chrono::steady_clock::now() + state->limits.dns_ttl;
+        std::lock_guard<std::mutex> guard(state->mtx);
+        state->dns[key] = r;
+        return r.endpoints;
     }
 };
 
@@ -173,6 +1570,8 @@ public:
         assert(p_io_service && "must init before listen.");
         assert(p_acceptor && "must listen before accept");
         auto server_sock = Socket(std::make_unique<boost::asio::ip::tcp::socket>(*p_io_service));
+        server_sock.set_io_mode(mode);
+        report(server_sock);
         p_acceptor->accept(*(server_sock.get_sock_ptr()));
         return server_sock;
     }
@@ -180,12 +1579,194 @@ public:
     Socket connect(const std::string& ip, int port)
     {
         assert(p_io_service && "io_service is nullptr");
+        if (pool) {
+            Socket pooled = pool->get(ip, port, mode);
+            report(pooled);
+            return pooled;
+        }
         Socket client_socket(*p_io_service);
+        client_socket.set_io_mode(mode);
+        report(client_socket);
         client_socket.connect(ip, port);
         return client_socket;
     }
+
+    // for the sockets made by accept() and connect() from now on
+    void set_io_mode(IOMode mode_){mode = mode_;}
+
+    // connect() reuses connections through a ConnectionPool from now on
+    void use_connection_pool(ConnectionPool::Limits limits = ConnectionPool::Limits())
+    {
+        assert(p_io_service && "io_service is nullptr");
+        pool = std::make_unique<ConnectionPool>(*p_io_service, limits);
+    }
+    ConnectionPool* connection_pool(){return pool.get();}
+
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+    // the sums over every Socket made by accept() and connect(), gone ones included
+    SocketStats snapshot() const { return totals->snapshot(); }
+#endif
 private:
+    IOMode mode = IOMode::handoff;
+    std::unique_ptr<ConnectionPool> pool;
     std::unique_ptr<boost::asio::ip::tcp::acceptor> p_acceptor;
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+    std::shared_ptr<detail::SocketMetrics> totals = std::make_shared<detail::SocketMetrics>();
+#endif
+
+    void report(Socket& s)
+    {
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+        s.metrics->parent = totals;
+#else
+        (void)s;
+#endif
+    }
+};
+
+#ifdef SCINART_CPPLIB_SOCKET_METRICS
+}
+#endif
+
+/**
+ * Class MultiCoreServer:
+ * Accepts connections to one port on several cores. Each core has its own io_service,
+ * run by a thread pinned to it, and its own listener bound with SO_REUSEPORT, so the
+ * kernel spreads incoming connections over the cores and no accept queue is shared.
+ *
+ *   MultiCoreServer server(port, [](MultiCoreServer::sock_ptr sock, boost::asio::io_service& io) {
+ *       auto conn = std::make_shared<Connection>(io, std::move(sock)); // e.g. on an AsyncSocket
+ *       conn->serve(conn);
+ *   });
+ *   ...
+ *   server.stop();
+ *
+ * handler runs on the thread of the core that accepted, with a socket of that core's
+ * io_service: served by async operations on io, the connection never leaves the core.
+ * handler must not block, it holds up the core's other connections. An exception
+ * escaping it terminates the program, like one escaping a thread.
+ *
+ * Without SO_REUSEPORT, only the first core listens.
+ */
+class MultiCoreServer
+{
+    using tcp = boost::asio::ip::tcp;
+public:
+    using sock_ptr = std::unique_ptr<tcp::socket>;
+    using Handler = std::function<void(sock_ptr, boost::asio::io_service&)>;
+
+    /**
+     * listen to ipv4 INADDR_ANY:$port with one listener per cpu of placement, which may
+     * name a cpu more than once. port 0 picks a free port, and is set to it.
+     */
+    MultiCoreServer(unsigned short& port, Handler handler_, Placement placement = Placement::all())
+        :handler(std::move(handler_))
+    {
+        if (placement.cpus.empty())
+            throw std::invalid_argument("MultiCoreServer needs at least one cpu");
+        for (int cpu : placement.cpus) {
+            cores.push_back(std::make_unique<Core>(cpu));
+            Core& core = *cores.back();
+#ifndef SO_REUSEPORT
+            if (cores.size() > 1) continue;
+#endif
+            core.acceptor.open(tcp::v4());
+            core.acceptor.set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+            core.acceptor.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+            core.acceptor.bind(tcp::endpoint(tcp::v4(), port));
+            core.acceptor.listen();
+            port = core.acceptor.local_endpoint().port();
+        }
+        running = cores.size();
+        for (auto& c : cores) {
+            Core& core = *c;
+            core.thread = std::thread([this, &core]() {
+                pin_this_thread(core.cpu);
+                if (core.acceptor.is_open())
+                    accept(core);
+                core.io_service.run();
+                std::lock_guard<std::mutex> guard(mtx);
+                running--;
+                cv.notify_all();
+            });
+        }
+    }
+    MultiCoreServer(const MultiCoreServer&) = delete;
+    ~MultiCoreServer(){ stop(); }
+
+    /**
+     * Close the listeners, then wait for each core to run out of work: the connections
+     * being served finish. After drain, the cores still busy are stopped, and the
+     * handlers they have pending are destroyed without running.
+     */
+    void stop(std::chrono::milliseconds drain = std::chrono::seconds(5))
+    {
+        if (stopped.exchange(true)) return;
+        for (auto& c : cores) {
+            Core& core = *c;
+            boost::asio::post(core.io_service, [&core]() {
+                boost::system::error_code ignored;
+                core.acceptor.close(ignored);
+                core.retry.cancel();
+            });
+        }
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait_for(lock, drain, [this]() { return running == 0; });
+        }
+        for (auto& c : cores) {
+            c->io_service.stop();
+            c->thread.join();
+        }
+    }
+
+    size_t size() const { return cores.size(); }
+    boost::asio::io_service& io_service(size_t core) { return cores.at(core)->io_service; }
+    int cpu(size_t core) const { return cores.at(core)->cpu; }
+    // connections accepted by core so far
+    size_t accepted(size_t core) const { return cores.at(core)->accepted.load(); }
+
+private:
+    struct Core
+    {
+        explicit Core(int cpu_):cpu(cpu_), acceptor(io_service), retry(io_service){}
+        int cpu;
+        boost::asio::io_service io_service; // before the objects using it, so destroyed after them
+        tcp::acceptor acceptor;
+        boost::asio::steady_timer retry;
+        std::atomic<size_t> accepted {0};
+        std::thread thread;
+    };
+
+    Handler handler;
+    std::vector<std::unique_ptr<Core>> cores;
+    std::atomic<bool> stopped {false};
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t running = 0; // cores whose io_service still has work
+
+    void accept(Core& core)
+    {
+        auto sock = std::make_shared<sock_ptr>(std::make_unique<tcp::socket>(core.io_service));
+        tcp::socket& s = **sock;
+        core.acceptor.async_accept(s, [this, &core, sock](const boost::system::error_code& ec) {
+            if (not core.acceptor.is_open())
+                return;
+            if (ec) {
+                // e.g. out of file descriptors: back off instead of spinning on the error
+                core.retry.expires_after(std::chrono::milliseconds(10));
+                core.retry.async_wait([this, &core](const boost::system::error_code& ec_) {
+                    if (not ec_ && core.acceptor.is_open()) accept(core);
+                });
+                return;
+            }
+            core.accepted++;
+            handler(std::move(*sock), core.io_service);
+            accept(core);
+        });
+    }
 };
 
 }
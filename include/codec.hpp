@@ -0,0 +1,363 @@
+#ifndef _GITHUB_SCINART_CPPLIB_CODEC_HPP_
+#define _GITHUB_SCINART_CPPLIB_CODEC_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "asio.hpp"
+
+namespace oy
+{
+
+enum class ByteOrder { native, little, big };
+
+namespace detail
+{
+
+template <ByteOrder order>
+constexpr bool needs_swap = order != ByteOrder::native &&
+    (order == ByteOrder::little) != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
+// copied as its bytes: trivially copyable, and not pointing into this process
+template <typename T>
+constexpr bool is_bitwise = std::is_trivially_copyable<T>::value && not std::is_pointer<T>::value && not std::is_member_pointer<T>::value;
+
+template <typename T>
+constexpr bool is_swappable = std::is_arithmetic<T>::value || std::is_enum<T>::value;
+
+template <typename T>
+T byteswap(T v)
+{
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "byteswap: unsupported size");
+    if constexpr (sizeof(T) == 1) {
+        return v;
+    } else {
+        using U = std::conditional_t<sizeof(T) == 2, uint16_t, std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>;
+        U u;
+        std::memcpy(&u, &v, sizeof(T));
+        if constexpr (sizeof(T) == 2) u = __builtin_bswap16(u);
+        else if constexpr (sizeof(T) == 4) u = __builtin_bswap32(u);
+        else u = __builtin_bswap64(u);
+        std::memcpy(&v, &u, sizeof(T));
+        return v;
+    }
+}
+
+// a plain loop over same-sized words: GCC and clang vectorize it into byte shuffles (pshufb, tbl)
+template <typename T>
+void byteswap_range(T* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        p[i] = byteswap(p[i]);
+}
+
+// the same, from p to the unaligned bytes at out
+template <typename T>
+void byteswap_copy(const T* p, size_t n, char* out)
+{
+    for (size_t i = 0; i < n; i++) {
+        T v = byteswap(p[i]);
+        std::memcpy(out + i * sizeof(T), &v, sizeof(T));
+    }
+}
+
+}
+
+/**
+ * How a T goes over a stream; specialize it for your own types:
+ *
+ *   template <> struct oy::Codec<Point> {
+ *       template <typename E> static void encode(E& e, const Point& p) { e.put(p.x); e.put(p.name); }
+ *       template <typename D> static void decode(D& d, Point& p) { d.get(p.x); d.get(p.name); }
+ *   };
+ *
+ * By default, a trivially copyable T is copied as its bytes, and a contiguous run of them
+ * as one block; anything else, pointers included, fails to compile.
+ * With a ByteOrder other than native, only arithmetic and enum values can be copied as bytes:
+ * structs need a specialization naming their fields.
+ */
+template <typename T, typename Enable = void>
+struct Codec
+{
+    static_assert(detail::is_bitwise<T>, "oy::Codec: T is a pointer or not trivially copyable; specialize oy::Codec<T>");
+    static constexpr bool bulk = true; // a run of T may be copied as one block
+
+    template <typename Encoder> static void encode(Encoder& e, const T& t) { e.put_range(&t, 1); }
+    template <typename Decoder> static void decode(Decoder& d, T& t) { d.get_range(&t, 1); }
+};
+
+namespace detail
+{
+template <typename T, typename = void> struct is_bulk : std::false_type {};
+template <typename T> struct is_bulk<T, std::void_t<decltype(Codec<T>::bulk)>> : std::bool_constant<Codec<T>::bulk> {};
+}
+
+/**
+ * Class Encoder:
+ * Lays out values as a list of buffers for one gathering write. Small values are copied
+ * into a scratch area; a large block of bytes in native order is referenced where it is,
+ * so it must live until the buffers are written.
+ */
+template <ByteOrder order = ByteOrder::native>
+class Encoder
+{
+public:
+    static constexpr size_t gather_threshold = 1024; // smaller blocks are copied
+
+    template <typename T> void put(const T& t) { Codec<T>::encode(*this, t); }
+    void put_length(size_t n) { put(uint64_t(n)); }
+
+    // n values of a bulk type, as one block
+    template <typename T> void put_range(const T* p, size_t n)
+    {
+        static_assert(detail::is_bitwise<T>, "Encoder::put_range: T is a pointer or not trivially copyable");
+        static_assert(not detail::needs_swap<order> || detail::is_swappable<T>,
+                      "Encoder: byte order conversion of a struct needs a Codec specialization naming its fields");
+        size_t bytes = n * sizeof(T);
+        if (bytes == 0) return;
+        if (not detail::needs_swap<order> && bytes >= gather_threshold) {
+            segments.push_back(Segment{reinterpret_cast<const char*>(p), 0, bytes});
+            return;
+        }
+        size_t offset = scratch.size();
+        scratch.resize(offset + bytes);
+        if constexpr (detail::needs_swap<order>)
+            detail::byteswap_copy(p, n, scratch.data() + offset);
+        else
+            std::memcpy(scratch.data() + offset, p, bytes);
+        if (not segments.empty() && not segments.back().external && segments.back().offset + segments.back().size == offset)
+            segments.back().size += bytes;
+        else
+            segments.push_back(Segment{nullptr, offset, bytes});
+    }
+
+    // valid until the next put()
+    std::vector<boost::asio::const_buffer> buffers() const
+    {
+        std::vector<boost::asio::const_buffer> b;
+        b.reserve(segments.size());
+        for (auto& s : segments)
+            b.emplace_back(s.external ? s.external : scratch.data() + s.offset, s.size);
+        return b;
+    }
+    size_t size() const
+    {
+        size_t n = 0;
+        for (auto& s : segments) n += s.size;
+        return n;
+    }
+
+private:
+    struct Segment
+    {
+        const char* external; // nullptr: in scratch, at offset
+        size_t offset;
+        size_t size;
+    };
+    std::vector<char> scratch;
+    std::vector<Segment> segments;
+};
+
+/**
+ * Class Decoder:
+ * Reads values from a stream with Socket's read(char*, size_t), in the layout of Encoder.
+ * The lengths read by one Decoder share a budget of max_bytes, nested ones included:
+ * a length whose elements would overdraw it fails with error::message_size before
+ * they are allocated. Use a Decoder per message.
+ */
+template <typename Stream, ByteOrder order = ByteOrder::native>
+class Decoder
+{
+public:
+    explicit Decoder(Stream& s_, size_t max_bytes = size_t(1) << 30):s(s_), budget(max_bytes){}
+
+    template <typename T> void get(T& t) { Codec<T>::decode(*this, t); }
+    // a length prefix, of elements taking element_size bytes each once decoded
+    size_t get_length(size_t element_size = 1)
+    {
+        uint64_t n;
+        get(n);
+        element_size = std::max<size_t>(element_size, 1);
+        if (n > budget / element_size)
+            throw boost::system::system_error(boost::asio::error::message_size);
+        budget -= size_t(n) * element_size;
+        return size_t(n);
+    }
+
+    template <typename T> void get_range(T* p, size_t n)
+    {
+        static_assert(detail::is_bitwise<T>, "Decoder::get_range: T is a pointer or not trivially copyable");
+        static_assert(not detail::needs_swap<order> || detail::is_swappable<T>,
+                      "Decoder: byte order conversion of a struct needs a Codec specialization naming its fields");
+        if (n == 0) return;
+        s.read(reinterpret_cast<char*>(p), n * sizeof(T));
+        if constexpr (detail::needs_swap<order>)
+            detail::byteswap_range(p, n);
+    }
+
+private:
+    Stream& s;
+    size_t budget; // bytes the lengths still may claim
+};
+
+template <typename C, typename Traits, typename A>
+struct Codec<std::basic_string<C, Traits, A>>
+{
+    template <typename Encoder> static void encode(Encoder& e, const std::basic_string<C, Traits, A>& t)
+    {
+        e.put_length(t.size());
+        e.put_range(t.data(), t.size());
+    }
+    template <typename Decoder> static void decode(Decoder& d, std::basic_string<C, Traits, A>& t)
+    {
+        t.resize(d.get_length(sizeof(C)));
+        d.get_range(&t[0], t.size());
+    }
+};
+
+template <typename T, typename A>
+struct Codec<std::vector<T, A>>
+{
+    template <typename Encoder> static void encode(Encoder& e, const std::vector<T, A>& t)
+    {
+        e.put_length(t.size());
+        if constexpr (detail::is_bulk<T>::value) {
+            e.put_range(t.data(), t.size());
+        } else {
+            for (const T& x : t) e.put(x);
+        }
+    }
+    template <typename Decoder> static void decode(Decoder& d, std::vector<T, A>& t)
+    {
+        t.resize(d.get_length(sizeof(T)));
+        if constexpr (detail::is_bulk<T>::value) {
+            d.get_range(t.data(), t.size());
+        } else {
+            for (T& x : t) d.get(x);
+        }
+    }
+};
+
+// not contiguous: one byte per element
+template <typename A>
+struct Codec<std::vector<bool, A>>
+{
+    template <typename Encoder> static void encode(Encoder& e, const std::vector<bool, A>& t)
+    {
+        e.put_length(t.size());
+        for (bool x : t) e.put(uint8_t(x));
+    }
+    template <typename Decoder> static void decode(Decoder& d, std::vector<bool, A>& t)
+    {
+        t.resize(d.get_length());
+        for (size_t i = 0; i < t.size(); i++) {
+            uint8_t x;
+            d.get(x);
+            t[i] = x != 0;
+        }
+    }
+};
+
+// no length prefix: N is known to both sides
+template <typename T, size_t N>
+struct Codec<std::array<T, N>>
+{
+    template <typename Encoder> static void encode(Encoder& e, const std::array<T, N>& t)
+    {
+        if constexpr (detail::is_bulk<T>::value) {
+            e.put_range(t.data(), N);
+        } else {
+            for (const T& x : t) e.put(x);
+        }
+    }
+    template <typename Decoder> static void decode(Decoder& d, std::array<T, N>& t)
+    {
+        if constexpr (detail::is_bulk<T>::value) {
+            d.get_range(t.data(), N);
+        } else {
+            for (T& x : t) d.get(x);
+        }
+    }
+};
+
+template <typename A, typename B>
+struct Codec<std::pair<A, B>>
+{
+    template <typename Encoder> static void encode(Encoder& e, const std::pair<A, B>& t) { e.put(t.first); e.put(t.second); }
+    template <typename Decoder> static void decode(Decoder& d, std::pair<A, B>& t) { d.get(t.first); d.get(t.second); }
+};
+
+namespace detail
+{
+// the length, then each key and value
+template <typename Map>
+struct MapCodec
+{
+    template <typename Encoder> static void encode(Encoder& e, const Map& t)
+    {
+        e.put_length(t.size());
+        for (auto& [k, v] : t) {
+            e.put(k);
+            e.put(v);
+        }
+    }
+    template <typename Decoder> static void decode(Decoder& d, Map& t)
+    {
+        t.clear();
+        size_t n = d.get_length(sizeof(typename Map::value_type));
+        for (size_t i = 0; i < n; i++) {
+            typename Map::key_type k;
+            d.get(k);
+            d.get(t[std::move(k)]);
+        }
+    }
+};
+}
+
+template <typename K, typename V, typename C, typename A>
+struct Codec<std::map<K, V, C, A>> : detail::MapCodec<std::map<K, V, C, A>> {};
+template <typename K, typename V, typename H, typename E, typename A>
+struct Codec<std::unordered_map<K, V, H, E, A>> : detail::MapCodec<std::unordered_map<K, V, H, E, A>> {};
+
+/**
+ * Write ts to s with a single gathering write:
+ *   encode(sock, header, names, weights);
+ *   encode<ByteOrder::big>(sock, header);
+ * s is Socket, UnixSocket, ShmChannel, or another detail::TypedStream.
+ */
+template <ByteOrder order = ByteOrder::native, typename Stream, typename... Ts>
+void encode(Stream& s, const Ts&... ts)
+{
+    Encoder<order> e;
+    (e.put(ts), ...);
+    auto b = e.buffers();
+    s.write_gather(b.data(), b.size());
+}
+
+// read values written by encode() into ts
+template <ByteOrder order = ByteOrder::native, typename Stream, typename... Ts>
+void decode(Stream& s, Ts&... ts)
+{
+    Decoder<Stream, order> d(s);
+    (d.get(ts), ...);
+}
+
+template <typename T, ByteOrder order = ByteOrder::native, typename Stream>
+T decode(Stream& s)
+{
+    T t;
+    decode<order>(s, t);
+    return t;
+}
+
+}
+
+#endif
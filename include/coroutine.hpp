@@ -0,0 +1,221 @@
+#ifndef _GITHUB_SCINART_CPPLIB_COROUTINE_HPP_
+#define _GITHUB_SCINART_CPPLIB_COROUTINE_HPP_
+
+// C++20 coroutines on top of TaskPool; empty when compiled as an older standard.
+#if __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+#include "parallel.hpp"
+#include "semaphore.hpp"
+
+namespace oy
+{
+
+template <typename T = void> class Task;
+
+namespace detail
+{
+
+struct TaskPromiseBase
+{
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            return h.promise().continuation; // symmetric transfer, no stack growth
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase
+{
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    template <typename U>
+    void return_value(U&& u) { value.emplace(std::forward<U>(u)); }
+    T result()
+    {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase
+{
+    Task<void> get_return_object();
+    void return_void() const noexcept {}
+    void result()
+    {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+// a coroutine nobody waits for: runs eagerly and frees itself at the end.
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+inline void resume_on(TaskPool& pool, std::coroutine_handle<> h)
+{
+    if (not pool.try_push([h]() { h.resume(); }))
+        h.resume();
+}
+
+}
+
+/**
+ * A lazily started coroutine returning T.
+ * co_await-ing it starts it, and the awaiting coroutine resumes where it finishes,
+ * by symmetric transfer. Exceptions propagate to the awaiter.
+ */
+template <typename T>
+class Task
+{
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task(Task&& rhs) noexcept : handle(std::exchange(rhs.handle, nullptr)) {}
+    Task& operator=(Task&& rhs) noexcept
+    {
+        if (this != &rhs) {
+            if (handle) handle.destroy();
+            handle = std::exchange(rhs.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() { if (handle) handle.destroy(); }
+
+    // an empty (moved-from) Task is ready at once, and throws std::logic_error on resume
+    bool await_ready() const noexcept { return not handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() { return promise().result(); }
+
+    // like co_await-ing the task, but leaves the result (or exception) in it.
+    auto when_ready() noexcept
+    {
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+            bool await_ready() const noexcept { return not handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{handle};
+    }
+
+    T result() { return promise().result(); }
+
+private:
+    promise_type& promise()
+    {
+        if (not handle)
+            throw std::logic_error("result of an empty Task");
+        return handle.promise();
+    }
+
+    friend promise_type;
+    explicit Task(std::coroutine_handle<promise_type> h):handle(h){}
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail
+{
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() { return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this)); }
+inline Task<void> TaskPromise<void>::get_return_object() { return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this)); }
+
+template <typename T>
+Detached signal_when_ready(Task<T>& task, Semaphore& done)
+{
+    co_await task.when_ready();
+    done.notify();
+}
+
+inline Detached run_detached(TaskPool& pool, Task<void> task)
+{
+    co_await pool.schedule();
+    co_await task;
+}
+}
+
+/**
+ * Run task on the calling thread until its first suspension, then block until it finishes.
+ */
+template <typename T>
+T sync_wait(Task<T> task)
+{
+    Semaphore done;
+    detail::signal_when_ready(task, done);
+    done.wait();
+    return task.result();
+}
+
+/**
+ * Start task on pool, and let nobody wait for it.
+ * An exception escaping task terminates the program, like one escaping a thread.
+ */
+inline void spawn(TaskPool& pool, Task<void> task)
+{
+    detail::run_detached(pool, std::move(task));
+}
+
+/**
+ * co_await async_wait(sem, pool) takes a unit of sem without holding a thread while
+ * the count is 0. The coroutine continues on a worker of pool.
+ */
+inline auto async_wait(Semaphore& sem, TaskPool& pool)
+{
+    struct Awaiter
+    {
+        Semaphore& sem;
+        TaskPool& pool;
+        bool await_ready() { return sem.try_wait(); }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            TaskPool* p = &pool;
+            sem.async_wait([p, h]() { detail::resume_on(*p, h); });
+        }
+        void await_resume() const noexcept {}
+    };
+    return Awaiter{sem, pool};
+}
+
+}
+
+#endif
+
+#endif
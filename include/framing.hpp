@@ -0,0 +1,275 @@
+#ifndef _GITHUB_SCINART_CPPLIB_FRAMING_HPP_
+#define _GITHUB_SCINART_CPPLIB_FRAMING_HPP_
+
+#include <boost/asio/error.hpp>
+#include <boost/system/system_error.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace oy
+{
+
+class SlabPool;
+
+namespace detail
+{
+
+struct SlabPoolState;
+
+// header of a slab, its bytes follow it in the same allocation
+struct alignas(std::max_align_t) Slab
+{
+    std::atomic<size_t> refs {1};
+    size_t capacity;
+    size_t used = 0;
+    std::shared_ptr<SlabPoolState> owner; // set while handed out, so views may outlive the pool
+
+    explicit Slab(size_t capacity_):capacity(capacity_){}
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+
+    static Slab* make(size_t capacity)
+    {
+        return new (::operator new(sizeof(Slab) + capacity)) Slab(capacity);
+    }
+    static void destroy(Slab* s)
+    {
+        s->~Slab();
+        ::operator delete(s);
+    }
+    inline void release();
+};
+
+struct SlabPoolState
+{
+    std::mutex mtx; // guards free; slabs come back from any thread
+    std::vector<Slab*> free;
+    size_t slab_size;
+    size_t max_free;
+
+    SlabPoolState(size_t slab_size_, size_t max_free_):slab_size(slab_size_), max_free(max_free_)
+    {
+        free.reserve(max_free);
+    }
+    ~SlabPoolState()
+    {
+        for (Slab* s : free) Slab::destroy(s);
+    }
+};
+
+inline void Slab::release()
+{
+    if (refs.fetch_sub(1) != 1) return;
+    std::shared_ptr<SlabPoolState> pool = std::move(owner);
+    if (pool && capacity == pool->slab_size) {
+        std::lock_guard<std::mutex> guard(pool->mtx);
+        if (pool->free.size() < pool->max_free) {
+            used = 0;
+            refs = 1;
+            pool->free.push_back(this);
+            return;
+        }
+    }
+    destroy(this);
+}
+
+}
+
+/**
+ * A ref-counted view of bytes inside a slab of a SlabPool.
+ * Copies share the bytes; when the last view of a slab goes, the slab returns to its pool.
+ */
+class BufferView
+{
+public:
+    BufferView() = default;
+    BufferView(const BufferView& rhs):slab(rhs.slab), ptr(rhs.ptr), len(rhs.len) { if (slab) slab->refs.fetch_add(1); }
+    BufferView(BufferView&& rhs) noexcept:slab(std::exchange(rhs.slab, nullptr)), ptr(rhs.ptr), len(std::exchange(rhs.len, 0)) {}
+    BufferView& operator=(BufferView rhs) noexcept
+    {
+        std::swap(slab, rhs.slab);
+        std::swap(ptr, rhs.ptr);
+        std::swap(len, rhs.len);
+        return *this;
+    }
+    ~BufferView() { if (slab) slab->release(); }
+
+    char* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    char* begin() const { return ptr; }
+    char* end() const { return ptr + len; }
+    std::string_view view() const { return std::string_view(ptr, len); }
+
+    // a part of this view, sharing its slab
+    BufferView sub(size_t offset, size_t n) const
+    {
+        BufferView v(*this);
+        v.ptr += offset;
+        v.len = n;
+        return v;
+    }
+
+private:
+    friend class SlabPool;
+    BufferView(detail::Slab* slab_, char* ptr_, size_t len_):slab(slab_), ptr(ptr_), len(len_){}
+
+    detail::Slab* slab = nullptr;
+    char* ptr = nullptr;
+    size_t len = 0;
+};
+
+/**
+ * Carves receive buffers out of slab_size-byte slabs, one connection's messages after another.
+ * A slab is reused once every view into it is gone; up to max_free idle slabs are kept,
+ * so a steady stream of messages allocates nothing.
+ * Messages larger than a slab get a slab of their own, freed with their last view.
+ *
+ * allocate() is for one thread at a time; views may be released on any thread,
+ * also after the pool is gone.
+ */
+class SlabPool
+{
+public:
+    explicit SlabPool(size_t slab_size = 64 << 10, size_t max_free = 16)
+        :state(std::make_shared<detail::SlabPoolState>(slab_size, max_free)){}
+    SlabPool(const SlabPool&) = delete;
+    ~SlabPool() { if (current) current->release(); }
+
+    BufferView allocate(size_t n)
+    {
+        if (n > state->slab_size) {
+            detail::Slab* s = detail::Slab::make(n);
+            s->used = n;
+            return BufferView(s, s->data(), n);
+        }
+        size_t start = current ? (current->used + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1) : 0;
+        if (not current || start + n > current->capacity) {
+            if (current) current->release();
+            current = take();
+            start = 0;
+        }
+        current->used = start + n;
+        current->refs.fetch_add(1);
+        return BufferView(current, current->data() + start, n);
+    }
+
+    size_t slab_size() const { return state->slab_size; }
+    size_t free_slabs() const
+    {
+        std::lock_guard<std::mutex> guard(state->mtx);
+        return state->free.size();
+    }
+
+private:
+    std::shared_ptr<detail::SlabPoolState> state;
+    detail::Slab* current = nullptr; // the slab being carved; the pool holds a reference
+
+    detail::Slab* take()
+    {
+        detail::Slab* s = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(state->mtx);
+            if (not state->free.empty()) {
+                s = state->free.back();
+                state->free.pop_back();
+            }
+        }
+        if (not s) s = detail::Slab::make(state->slab_size);
+        s->owner = state;
+        return s;
+    }
+};
+
+enum class LengthPrefix
+{
+    varint,     // LEB128, 1 byte up to 127
+    fixed32     // 4 bytes, big endian
+};
+
+struct FrameFormat
+{
+    LengthPrefix prefix = LengthPrefix::varint;
+    size_t max_size = 16 << 20; // larger frames fail with error::message_size
+};
+
+/**
+ * Send payload as one frame: its length, then its bytes, with one write_all().
+ * Stream is Socket, or anything with the same write_all and read(char*, size_t).
+ */
+template <typename Stream>
+void write_frame(Stream& s, std::string_view payload, const FrameFormat& format = FrameFormat())
+{
+    if (payload.size() > format.max_size || (format.prefix == LengthPrefix::fixed32 && payload.size() > UINT32_MAX))
+        throw boost::system::system_error(boost::asio::error::message_size);
+    char prefix[10];
+    size_t n = 0;
+    uint64_t len = payload.size();
+    if (format.prefix == LengthPrefix::varint) {
+        do {
+            prefix[n++] = char((len & 0x7f) | (len >= 0x80 ? 0x80 : 0));
+            len >>= 7;
+        } while (len);
+    } else {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            prefix[n++] = char(len >> shift);
+    }
+    s.write_all(std::string_view(prefix, n), payload);
+}
+
+namespace detail
+{
+template <typename T, typename = void> struct has_set_broken : std::false_type {};
+template <typename T> struct has_set_broken<T, decltype(std::declval<T&>().set_broken())> : std::true_type {};
+
+// a refused frame leaves the stream mid-message: keep a Socket from going back to its ConnectionPool
+template <typename Stream>
+[[noreturn]] void refuse_frame(Stream& s)
+{
+    if constexpr (has_set_broken<Stream>::value)
+        s.set_broken();
+    throw boost::system::system_error(boost::asio::error::message_size);
+}
+}
+
+/**
+ * Receive one frame into a buffer from pool. A varint prefix is read byte by byte,
+ * which wants a Socket with a read buffer.
+ * A frame above format.max_size fails with error::message_size, and breaks a Socket.
+ */
+template <typename Stream>
+BufferView read_frame(Stream& s, SlabPool& pool, const FrameFormat& format = FrameFormat())
+{
+    uint64_t len = 0;
+    if (format.prefix == LengthPrefix::varint) {
+        for (int shift = 0; ; shift += 7) {
+            if (shift > 63)
+                detail::refuse_frame(s);
+            unsigned char byte;
+            s.read(reinterpret_cast<char*>(&byte), 1);
+            len |= uint64_t(byte & 0x7f) << shift;
+            if (not (byte & 0x80)) break;
+        }
+    } else {
+        unsigned char bytes[4];
+        s.read(reinterpret_cast<char*>(bytes), 4);
+        for (unsigned char b : bytes)
+            len = len << 8 | b;
+    }
+    if (len > format.max_size)
+        detail::refuse_frame(s);
+    BufferView v = pool.allocate(len);
+    if (len) s.read(v.data(), len);
+    return v;
+}
+
+}
+
+#endif
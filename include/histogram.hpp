@@ -0,0 +1,107 @@
+#ifndef _GITHUB_SCINART_CPPLIB_HISTOGRAM_HPP_
+#define _GITHUB_SCINART_CPPLIB_HISTOGRAM_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace oy
+{
+
+/**
+ * HDR-style histogram of non-negative integers, typically nanoseconds.
+ * Values are bucketed by power of two, and each power of two is split into
+ * 2^SubBits linear sub-buckets, so a bucket is at most 1/8 of its value wide.
+ *
+ * Counters are relaxed atomics: one thread records, another may merge a copy at any time.
+ */
+class LogHistogram
+{
+public:
+    static constexpr unsigned int SubBits = 3;
+    static constexpr unsigned int Buckets = (64 - SubBits + 1) << SubBits;
+
+    LogHistogram() = default;
+    LogHistogram(const LogHistogram& rhs) { merge(rhs); }
+    LogHistogram& operator=(const LogHistogram& rhs)
+    {
+        if (this != &rhs) { clear(); merge(rhs); }
+        return *this;
+    }
+
+    static unsigned int bucket_of(uint64_t v)
+    {
+        if (v < (1u << SubBits)) return v;
+        unsigned int shift = 63 - __builtin_clzll(v) - SubBits;
+        return ((shift + 1) << SubBits) + ((v >> shift) & ((1u << SubBits) - 1));
+    }
+    // smallest value falling into bucket i
+    static uint64_t lower_bound(unsigned int i)
+    {
+        if (i < (1u << SubBits)) return i;
+        unsigned int shift = (i >> SubBits) - 1;
+        return (uint64_t((1u << SubBits) + (i & ((1u << SubBits) - 1)))) << shift;
+    }
+
+    void record(uint64_t v, uint64_t n = 1)
+    {
+        counts[bucket_of(v)].fetch_add(n, std::memory_order_relaxed);
+        total.fetch_add(n, std::memory_order_relaxed);
+        sum_.fetch_add(v * n, std::memory_order_relaxed);
+        uint64_t m = max_.load(std::memory_order_relaxed);
+        while (v > m && not max_.compare_exchange_weak(m, v, std::memory_order_relaxed));
+    }
+
+    void merge(const LogHistogram& rhs)
+    {
+        for (unsigned int i = 0; i < Buckets; i++)
+            if (uint64_t c = rhs.counts[i].load(std::memory_order_relaxed))
+                counts[i].fetch_add(c, std::memory_order_relaxed);
+        total.fetch_add(rhs.count(), std::memory_order_relaxed);
+        sum_.fetch_add(rhs.sum(), std::memory_order_relaxed);
+        uint64_t m = rhs.max();
+        uint64_t cur = max_.load(std::memory_order_relaxed);
+        while (m > cur && not max_.compare_exchange_weak(cur, m, std::memory_order_relaxed));
+    }
+
+    void clear()
+    {
+        for (auto& c : counts) c.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    double mean() const { return count() ? double(sum()) / count() : 0; }
+    uint64_t bucket_count(unsigned int i) const { return counts[i].load(std::memory_order_relaxed); }
+
+    /**
+     * Lower bound of the bucket holding the p-th quantile, p in [0, 1].
+     */
+    uint64_t percentile(double p) const
+    {
+        uint64_t n = count();
+        if (n == 0) return 0;
+        uint64_t rank = p <= 0 ? 1 : p >= 1 ? n : uint64_t(p * n + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (unsigned int i = 0; i < Buckets; i++) {
+            seen += bucket_count(i);
+            if (seen >= rank) return lower_bound(i);
+        }
+        return max();
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, Buckets> counts {};
+    std::atomic<uint64_t> total {0};
+    std::atomic<uint64_t> sum_ {0};
+    std::atomic<uint64_t> max_ {0};
+};
+
+}
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef _GITHUB_SCINART_CPPLIB_IPC_HPP_
+#define _GITHUB_SCINART_CPPLIB_IPC_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "asio.hpp"
+
+namespace oy
+{
+
+/**
+ * Class UnixSocket:
+ * A stream over an AF_UNIX socket, with Socket's typed read/write (see detail::TypedStream),
+ * for peers on the same host. It always does its I/O inline: non-blocking system calls,
+ * waiting in poll(), like Socket in IOMode::inline_poll.
+ */
+class UnixSocket : public detail::TypedStream<UnixSocket>
+{
+    friend class detail::TypedStream<UnixSocket>;
+    using protocol = boost::asio::local::stream_protocol;
+public:
+    using sock_ptr = std::unique_ptr<protocol::socket>;
+
+    UnixSocket(boost::asio::io_service& io_service_):io_service(io_service_){}
+    UnixSocket(boost::asio::io_service& io_service_, sock_ptr&& ptr):io_service(io_service_), sock(std::move(ptr))
+    {
+        sock->non_blocking(true);
+    }
+    UnixSocket(UnixSocket&& rhs) = default;
+    ~UnixSocket(){ boost::system::error_code ec; if(sock) sock->shutdown(protocol::socket::shutdown_both, ec); }
+
+    // connecting to a listening path does not wait: it fails at once if nobody listens
+    void connect(const std::string& path)
+    {
+        sock = std::make_unique<protocol::socket>(io_service);
+        sock->connect(protocol::endpoint(path));
+        sock->non_blocking(true);
+    }
+
+    sock_ptr& get_sock_ptr(){return sock;}
+    template<typename Duration> void set_read_timeout (Duration d){rtimeout = std::chrono::duration_cast<decltype(rtimeout)>(d);}
+    // 0, the default, waits forever.
+    template<typename Duration> void set_write_timeout(Duration d){wtimeout = std::chrono::duration_cast<decltype(wtimeout)>(d);}
+
+private:
+    boost::asio::io_service& io_service;
+    sock_ptr sock;
+    std::chrono::milliseconds rtimeout = std::chrono::seconds(1);
+    std::chrono::milliseconds wtimeout {0};
+
+    void read_buffer(boost::asio::mutable_buffer buffer)
+    {
+        auto deadline = std::chrono::steady_clock::now() + rtimeout;
+        while (buffer.size())
+            buffer += detail::recv_some(sock->native_handle(), buffer, deadline);
+    }
+    void write_buffers(const boost::asio::const_buffer* bufs, size_t count)
+    {
+        auto deadline = wtimeout.count() ? std::chrono::steady_clock::now() + wtimeout : std::chrono::steady_clock::time_point::max();
+        detail::send_all(sock->native_handle(), bufs, count, deadline);
+    }
+};
+
+/**
+ * Listens on a filesystem path for UnixSocket connections.
+ * A file left at path by an earlier listener is replaced; the path is removed on destruction.
+ */
+class UnixListener
+{
+    using protocol = boost::asio::local::stream_protocol;
+public:
+    UnixListener(boost::asio::io_service& io_service_, std::string path_)
+        :io_service(io_service_), path(std::move(path_)), acceptor(io_service_)
+    {
+        ::unlink(path.c_str());
+        acceptor.open(protocol());
+        acceptor.bind(protocol::endpoint(path));
+        acceptor.listen();
+    }
+    UnixListener(const UnixListener&) = delete;
+    ~UnixListener()
+    {
+        boost::system::error_code ignored;
+        acceptor.close(ignored);
+        ::unlink(path.c_str());
+    }
+
+    UnixSocket accept()
+    {
+        auto sock = std::make_unique<protocol::socket>(io_service);
+        acceptor.accept(*sock);
+        return UnixSocket(io_service, std::move(sock));
+    }
+
+private:
+    boost::asio::io_service& io_service;
+    std::string path;
+    protocol::acceptor acceptor;
+};
+
+#ifdef __linux__
+namespace detail
+{
+
+// park()/unpark() for words in memory shared between processes
+inline bool park_shared_until(const void* word, uint32_t expected, std::chrono::steady_clock::time_point deadline)
+{
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+        syscall(SYS_futex, word, FUTEX_WAIT, expected, nullptr, nullptr, 0);
+        return true;
+    }
+    auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= left.zero()) return false;
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(left);
+    timespec ts;
+    ts.tv_sec = secs.count();
+    ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(left - secs).count();
+    return not (syscall(SYS_futex, word, FUTEX_WAIT, expected, &ts, nullptr, 0) == -1 && errno == ETIMEDOUT);
+}
+
+inline void unpark_shared(const void* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+/**
+ * One direction of a ShmChannel: a byte ring with a single writer and a single reader.
+ * head and tail only grow; the writer owns tail, the reader owns head. A side about to
+ * sleep raises its waiting flag and parks on its sequence word; the other side bumps
+ * the word and wakes it only when the flag is up, so a busy stream makes no system calls.
+ */
+struct ShmRing
+{
+    alignas(64) std::atomic<uint64_t> tail {0};
+    std::atomic<uint32_t> data_seq {0};
+    std::atomic<uint32_t> reader_waiting {0};
+    alignas(64) std::atomic<uint64_t> head {0};
+    std::atomic<uint32_t> space_seq {0};
+    std::atomic<uint32_t> writer_waiting {0};
+};
+
+struct ShmSegment
+{
+    static constexpr uint64_t ready_magic = 0x6f792d73686d3031; // "oy-shm01"
+    std::atomic<uint64_t> magic {0}; // set last by the creator
+    uint64_t capacity;               // of each ring, a power of 2
+    std::atomic<uint32_t> closed[2] = {{0}, {0}}; // by side
+    ShmRing rings[2];                // rings[i] is written by side i
+
+    explicit ShmSegment(uint64_t capacity_):capacity(capacity_){}
+    char* data(int ring) { return reinterpret_cast<char*>(this + 1) + ring * capacity; }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "ShmChannel needs address-free atomics");
+
+}
+
+/**
+ * Class ShmChannel:
+ * A stream between two processes (or threads) on one host through a shared memory segment:
+ * a ring per direction, so a message costs two memcpy()s and, when the peer is asleep,
+ * one futex wake. It has Socket's typed read/write (see detail::TypedStream).
+ *
+ *   auto server = ShmChannel::create("/my-channel");  // side 0
+ *   auto client = ShmChannel::open("/my-channel");    // side 1, in the other process
+ *
+ * A waiting side spins briefly, then sleeps on a futex in the segment.
+ * Reading from a channel whose peer is gone throws eof once the ring is drained;
+ * writing to it throws broken_pipe. The creator removes the name when destroyed;
+ * an opened channel stays usable.
+ */
+class ShmChannel : public detail::TypedStream<ShmChannel>
+{
+    friend class detail::TypedStream<ShmChannel>;
+public:
+    // capacity: bytes of each ring, a power of 2
+    static ShmChannel create(const std::string& name, size_t capacity = 1 << 20)
+    {
+        if (capacity < 64 || (capacity & (capacity - 1)))
+            throw std::invalid_argument("ShmChannel: capacity must be a power of 2, at least 64");
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) throw_errno();
+        size_t size = sizeof(detail::ShmSegment) + 2 * capacity;
+        if (::ftruncate(fd, size) != 0) {
+            int err = errno;
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw_errno(err);
+        }
+        ShmChannel c(fd, size, 0);
+        c.owned_name = name;
+        new (c.segment) detail::ShmSegment(capacity);
+        c.segment->magic.store(detail::ShmSegment::ready_magic, std::memory_order_release);
+        return c;
+    }
+
+    static ShmChannel open(const std::string& name)
+    {
+        int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) throw_errno();
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw_errno(err);
+        }
+        if (size_t(st.st_size) < sizeof(detail::ShmSegment)) {
+            ::close(fd);
+            throw boost::system::system_error(boost::asio::error::try_again); // not set up yet
+        }
+        ShmChannel c(fd, st.st_size, 1);
+        if (c.segment->magic.load(std::memory_order_acquire) != detail::ShmSegment::ready_magic)
+            throw boost::system::system_error(boost::asio::error::try_again);
+        return c;
+    }
+
+    ShmChannel(ShmChannel&& rhs) noexcept
+        :segment(std::exchange(rhs.segment, nullptr)), size(rhs.size), side(rhs.side),
+         owned_name(std::move(rhs.owned_name)), rtimeout(rhs.rtimeout), wtimeout(rhs.wtimeout){}
+    ShmChannel(const ShmChannel&) = delete;
+    ~ShmChannel()
+    {
+        if (not segment) return;
+        if (segment->magic.load() == detail::ShmSegment::ready_magic) {
+            segment->closed[side].store(1);
+            // the peer may sleep waiting for data from us, or for room in the ring it writes
+            detail::ShmRing& out = segment->rings[side];
+            detail::ShmRing& in = segment->rings[1 - side];
+            out.data_seq.fetch_add(1);
+            detail::unpark_shared(&out.data_seq);
+            in.space_seq.fetch_add(1);
+            detail::unpark_shared(&in.space_seq);
+        }
+        ::munmap(segment, size);
+        if (not owned_name.empty())
+            ::shm_unlink(owned_name.c_str());
+    }
+
+    template<typename Duration> void set_read_timeout (Duration d){rtimeout = std::chrono::duration_cast<decltype(rtimeout)>(d);}
+    // 0, the default, waits forever.
+    template<typename Duration> void set_write_timeout(Duration d){wtimeout = std::chrono::duration_cast<decltype(wtimeout)>(d);}
+    size_t capacity() const { return segment->capacity; }
+
+private:
+    detail::ShmSegment* segment = nullptr;
+    size_t size = 0;
+    int side = 0;
+    std::string owned_name; // set on the creating side
+    std::chrono::milliseconds rtimeout = std::chrono::seconds(1);
+    std::chrono::milliseconds wtimeout {0};
+
+    static constexpr int spin_limit = 256;
+
+    ShmChannel(int fd, size_t size_, int side_):size(size_), side(side_)
+    {
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (p == MAP_FAILED) throw_errno(err);
+        segment = static_cast<detail::ShmSegment*>(p);
+    }
+
+    [[noreturn]] static void throw_errno(int err = errno)
+    {
+        throw boost::system::system_error(boost::system::error_code(err, boost::system::system_category()));
+    }
+
+    bool peer_closed() const { return segment->closed[1 - side].load() != 0; }
+
+    /**
+     * Wait until ready() holds, or the peer is gone; false once deadline passed.
+     * seq and waiting are the word and flag of this side in the ring; ready() loads
+     * with seq_cst, so it cannot miss a store the other side made before checking waiting.
+     */
+    template <typename Ready>
+    bool wait(Ready ready, std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiting, std::chrono::steady_clock::time_point deadline)
+    {
+        for (int i = 0; i < spin_limit; i++) {
+            if (ready() || peer_closed()) return true;
+            detail::cpu_relax();
+        }
+        while (true) {
+            uint32_t s = seq.load();
+            waiting.store(1);
+            if (ready() || peer_closed()) {
+                waiting.store(0);
+                return true;
+            }
+            bool in_time = detail::park_shared_until(&seq, s, deadline);
+            waiting.store(0);
+            if (not in_time && not ready()) return false;
+        }
+    }
+
+    void read_buffer(boost::asio::mutable_buffer buffer)
+    {
+        detail::ShmRing& ring = segment->rings[1 - side];
+        const char* data = segment->data(1 - side);
+        const uint64_t cap = segment->capacity;
+        auto deadline = std::chrono::steady_clock::now() + rtimeout;
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        while (buffer.size()) {
+            uint64_t tail = ring.tail.load(std::memory_order_acquire);
+            if (tail == head) {
+                if (not wait([&]() { return ring.tail.load() != head; }, ring.data_seq, ring.reader_waiting, deadline))
+                    throw boost::system::system_error(boost::asio::error::try_again);
+                if (ring.tail.load(std::memory_order_acquire) == head)
+                    throw boost::system::system_error(boost::asio::error::eof);
+                continue;
+            }
+            size_t n = std::min<uint64_t>(tail - head, buffer.size());
+            size_t pos = head & (cap - 1);
+            size_t first = std::min<size_t>(n, cap - pos);
+            std::memcpy(buffer.data(), data + pos, first);
+            std::memcpy(static_cast<char*>(buffer.data()) + first, data, n - first);
+            buffer += n;
+            head += n;
+            ring.head.store(head); // seq_cst: ordered before the load of writer_waiting
+            if (ring.writer_waiting.load()) {
+                ring.space_seq.fetch_add(1);
+                detail::unpark_shared(&ring.space_seq);
+            }
+        }
+    }
+
+    void write_buffers(const boost::asio::const_buffer* bufs, size_t count)
+    {
+        detail::ShmRing& ring = segment->rings[side];
+        char* data = segment->data(side);
+        const uint64_t cap = segment->capacity;
+        auto deadline = wtimeout.count() ? std::chrono::steady_clock::now() + wtimeout : std::chrono::steady_clock::time_point::max();
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < count; i++) {
+            const char* p = static_cast<const char*>(bufs[i].data());
+            size_t left = bufs[i].size();
+            while (left) {
+                if (peer_closed())
+                    throw boost::system::system_error(boost::asio::error::broken_pipe);
+                uint64_t room = cap - (tail - ring.head.load(std::memory_order_acquire));
+                if (room == 0) {
+                    if (not wait([&]() { return ring.head.load() + cap != tail; }, ring.space_seq, ring.writer_waiting, deadline))
+                        throw boost::system::system_error(boost::asio::error::try_again);
+                    continue;
+                }
+                size_t n = std::min<uint64_t>(room, left);
+                size_t pos = tail & (cap - 1);
+                size_t first = std::min<size_t>(n, cap - pos);
+                std::memcpy(data + pos, p, first);
+                std::memcpy(data, p + first, n - first);
+                p += n;
+                left -= n;
+                tail += n;
+                // publish each chunk, so a reader can drain a message larger than the ring
+                ring.tail.store(tail); // seq_cst: ordered before the load of reader_waiting
+                if (ring.reader_waiting.load()) {
+                    ring.data_seq.fetch_add(1);
+                    detail::unpark_shared(&ring.data_seq);
+                }
+            }
+        }
+    }
+};
+#endif
+
+}
+
+#endif
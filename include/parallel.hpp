@@ -0,0 +1,365 @@
+#ifndef _GITHUB_SCINART_CPPLIB_PARALLEL_HPP_
+#define _GITHUB_SCINART_CPPLIB_PARALLEL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#endif
+
+#include "thread_pool.hpp"
+
+namespace oy
+{
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+inline namespace distributor_metrics // TaskPool changes layout with metrics, see thread_pool.hpp
+{
+#endif
+
+/**
+ * A Distributor whose items are the work itself.
+ * Shared by the parallel_* algorithms below.
+ */
+class TaskPool : public Distributor<std::function<void()>>
+{
+public:
+    using Task = std::function<void()>;
+
+    TaskPool(unsigned int concurrency = std::thread::hardware_concurrency(),
+             size_t capacity = 4 * std::thread::hardware_concurrency())
+        :Distributor<Task>([](Task task) { task(); }, concurrency, capacity) {}
+
+    /**
+     * Run one queued task on the calling thread.
+     * return false if there was nothing to run.
+     */
+    bool run_one()
+    {
+        Task task;
+        if (not try_pop(task)) return false;
+        task();
+        return true;
+    }
+
+#if __cpp_impl_coroutine >= 201902L
+    /**
+     * co_await pool.schedule() continues the coroutine on a worker,
+     * or right away on the current thread if the queue is full.
+     */
+    auto schedule()
+    {
+        struct Awaiter
+        {
+            TaskPool& pool;
+            bool await_ready() const noexcept { return false; }
+            bool await_suspend(std::coroutine_handle<> h) { return pool.try_push([h]() { h.resume(); }); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+#endif
+};
+
+inline TaskPool& default_task_pool()
+{
+    static TaskPool pool;
+    return pool;
+}
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+}
+#endif
+
+namespace detail
+{
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+inline namespace distributor_metrics
+{
+#endif
+
+/**
+ * Tasks handed to a pool by one caller, counted down as they finish.
+ * wait() helps with queued tasks; with none left, it sleeps until the count is zero.
+ */
+class JoinCounter
+{
+    std::atomic<size_t> outstanding {0};
+    std::mutex mtx; // done() notifies joined under it
+    std::condition_variable joined;
+public:
+    void add(size_t n = 1) { outstanding.fetch_add(n); }
+    size_t count() const { return outstanding.load(); }
+
+    // under the lock: the joining thread may destroy this as soon as it sees zero
+    void done(size_t n = 1)
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        if (outstanding.fetch_sub(n) == n)
+            joined.notify_all();
+    }
+
+    // looks for new tasks in pool now and then while sleeping
+    void wait(TaskPool& pool)
+    {
+        while (outstanding.load() != 0) {
+            if (pool.run_one()) continue;
+            std::unique_lock<std::mutex> lock(mtx);
+            joined.wait_for(lock, std::chrono::milliseconds(1), [this]() { return outstanding.load() == 0; });
+        }
+        std::lock_guard<std::mutex> guard(mtx); // the last done() may not have unlocked yet
+    }
+};
+
+/**
+ * Tasks forked from one caller, and joined by it.
+ * The caller does not block in join(), it runs queued tasks until its own ones are done.
+ */
+class ForkJoin
+{
+    TaskPool& pool;
+    JoinCounter tasks;
+    std::atomic<bool> failed_ {false};
+    std::mutex mtx; // guards error
+    std::exception_ptr error;
+public:
+    explicit ForkJoin(TaskPool& pool_):pool(pool_){}
+    ForkJoin(const ForkJoin&) = delete;
+    ~ForkJoin() { tasks.wait(pool); }
+
+    // lazy splitting: only give work away when the pool has nothing queued.
+    bool idle() { return pool.pending() == 0; }
+    bool failed() const { return failed_.load(std::memory_order_relaxed); }
+
+    /**
+     * Hand f to the pool if a worker could pick it up soon.
+     * on false, the caller should run f itself.
+     */
+    template <typename Function>
+    bool spawn(Function f)
+    {
+        if (not idle()) return false;
+        tasks.add();
+        if (pool.try_push([this, f]() { invoke(f); tasks.done(); }))
+            return true;
+        tasks.done();
+        return false;
+    }
+
+    template <typename Function>
+    void invoke(const Function& f)
+    {
+        try {
+            if (not failed()) f();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(mtx);
+            if (not error) error = std::current_exception();
+            failed_ = true;
+        }
+    }
+
+    // wait for the spawned tasks and rethrow the first exception, if any.
+    void join()
+    {
+        tasks.wait(pool);
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+template <typename Index>
+Index default_grain(TaskPool& pool, Index begin, Index end)
+{
+    Index chunks = static_cast<Index>(8 * (pool.concurrency() + 1));
+    return std::max<Index>(1, (end - begin) / chunks);
+}
+
+// run body on [b, e) by chunks of grain, giving the upper half away whenever the pool is idle.
+template <typename Index, typename Body>
+void run_range(ForkJoin& group, Index b, Index e, Index grain, const Body& body)
+{
+    while (b < e && not group.failed()) {
+        if (e - b > grain && group.idle()) {
+            Index mid = b + (e - b) / 2;
+            if (group.spawn([&group, &body, mid, e, grain]() { run_range(group, mid, e, grain, body); })) {
+                e = mid;
+                continue;
+            }
+        }
+        Index next = e - b > grain ? b + grain : e;
+        body(b, next);
+        b = next;
+    }
+}
+
+// same splitting as run_range, but each task folds its chunks into one partial result.
+template <typename Index, typename T, typename Reduce, typename Partials>
+void reduce_range(ForkJoin& group, Index b, Index e, Index grain,
+                  const T& identity, const Reduce& reduce, Partials& partials)
+{
+    const Index first = b;
+    T acc = identity;
+    while (b < e && not group.failed()) {
+        if (e - b > grain && group.idle()) {
+            Index mid = b + (e - b) / 2;
+            if (group.spawn([&, mid, e, grain]() { reduce_range(group, mid, e, grain, identity, reduce, partials); })) {
+                e = mid;
+                continue;
+            }
+        }
+        Index next = e - b > grain ? b + grain : e;
+        acc = reduce(b, next, std::move(acc));
+        b = next;
+    }
+    partials.add(first, std::move(acc));
+}
+
+template <typename Index, typename T>
+class Partials
+{
+    std::mutex mtx;
+    std::vector<std::pair<Index, T>> v;
+public:
+    void add(Index first, T&& value)
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        v.emplace_back(first, std::move(value));
+    }
+    // fold in index order, so combine needs to be associative but not commutative.
+    template <typename Combine>
+    T fold(T init, const Combine& combine)
+    {
+        std::sort(v.begin(), v.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (auto& p : v)
+            init = combine(std::move(init), std::move(p.second));
+        return init;
+    }
+};
+
+template <typename RandomIt, typename Compare>
+void merge_sort(TaskPool& pool, RandomIt first, RandomIt last, const Compare& comp, size_t cutoff)
+{
+    if (static_cast<size_t>(last - first) <= cutoff) {
+        std::sort(first, last, comp);
+        return;
+    }
+    RandomIt mid = first + (last - first) / 2;
+    ForkJoin group(pool);
+    group.invoke([&]() {
+        if (not group.spawn([&pool, first, mid, &comp, cutoff]() { merge_sort(pool, first, mid, comp, cutoff); }))
+            merge_sort(pool, first, mid, comp, cutoff);
+        merge_sort(pool, mid, last, comp, cutoff);
+    });
+    group.join();
+    std::inplace_merge(first, mid, last, comp);
+}
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+}
+#endif
+}
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+inline namespace distributor_metrics
+{
+#endif
+
+/**
+ * f(i) for every i in [begin, end).
+ * Iterations are handed out by chunks of grain; grain 0 picks one from the range size.
+ * The calling thread takes part in the work, and rethrows the first exception thrown by f.
+ */
+template <typename Index, typename Function>
+void parallel_for(TaskPool& pool, Index begin, std::common_type_t<Index> end,
+                  std::common_type_t<Index> grain, Function f)
+{
+    static_assert(std::is_integral<Index>::value, "parallel_for works on integral indices");
+    if (not (begin < end)) return;
+    if (grain == 0) grain = detail::default_grain(pool, begin, end);
+    auto body = [&f](Index b, Index e) { for (; b < e; ++b) f(b); };
+    detail::ForkJoin group(pool);
+    group.invoke([&]() { detail::run_range(group, begin, end, grain, body); });
+    group.join();
+}
+
+template <typename Index, typename Function>
+void parallel_for(Index begin, std::common_type_t<Index> end, std::common_type_t<Index> grain, Function f)
+{
+    parallel_for(default_task_pool(), begin, end, grain, std::move(f));
+}
+
+/**
+ * reduce(b, e, acc) folds [b, e) into acc and returns it.
+ * combine(x, y) merges two partial results; partials are combined in index order.
+ */
+template <typename Index, typename T, typename Reduce, typename Combine>
+T parallel_reduce(TaskPool& pool, Index begin, std::common_type_t<Index> end, std::common_type_t<Index> grain,
+                  T identity, Reduce reduce, Combine combine)
+{
+    static_assert(std::is_integral<Index>::value, "parallel_reduce works on integral indices");
+    if (not (begin < end)) return identity;
+    if (grain == 0) grain = detail::default_grain(pool, begin, end);
+    detail::Partials<Index, T> partials;
+    detail::ForkJoin group(pool);
+    group.invoke([&]() { detail::reduce_range(group, begin, end, grain, identity, reduce, partials); });
+    group.join();
+    return partials.fold(identity, combine);
+}
+
+template <typename Index, typename T, typename Reduce, typename Combine>
+T parallel_reduce(Index begin, std::common_type_t<Index> end, std::common_type_t<Index> grain,
+                  T identity, Reduce reduce, Combine combine)
+{
+    return parallel_reduce(default_task_pool(), begin, end, grain, std::move(identity), std::move(reduce), std::move(combine));
+}
+
+/**
+ * std::transform over random access iterators.
+ */
+template <typename RandomIt, typename OutputIt, typename Function>
+OutputIt parallel_transform(TaskPool& pool, RandomIt first, RandomIt last, OutputIt out, Function f, size_t grain = 0)
+{
+    size_t n = last - first;
+    parallel_for(pool, size_t(0), n, grain, [&](size_t i) { out[i] = f(first[i]); });
+    return out + n;
+}
+
+template <typename RandomIt, typename OutputIt, typename Function>
+OutputIt parallel_transform(RandomIt first, RandomIt last, OutputIt out, Function f, size_t grain = 0)
+{
+    return parallel_transform(default_task_pool(), first, last, out, std::move(f), grain);
+}
+
+/**
+ * Merge sort: halves are sorted in parallel while the pool is idle, below cutoff std::sort is used.
+ * Not stable.
+ */
+template <typename RandomIt, typename Compare = std::less<typename std::iterator_traits<RandomIt>::value_type>>
+void parallel_sort(TaskPool& pool, RandomIt first, RandomIt last, Compare comp = Compare(), size_t cutoff = 2048)
+{
+    detail::merge_sort(pool, first, last, comp, std::max<size_t>(cutoff, 1));
+}
+
+template <typename RandomIt, typename Compare = std::less<typename std::iterator_traits<RandomIt>::value_type>>
+void parallel_sort(RandomIt first, RandomIt last, Compare comp = Compare(), size_t cutoff = 2048)
+{
+    parallel_sort(default_task_pool(), first, last, comp, cutoff);
+}
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+}
+#endif
+
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef _GITHUB_SCINART_CPPLIB_PIPELINE_HPP_
+#define _GITHUB_SCINART_CPPLIB_PIPELINE_HPP_
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "parallel.hpp"
+
+namespace oy
+{
+
+enum class StageMode { parallel, serial_in_order, serial_out_of_order };
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+inline namespace distributor_metrics // Pipeline holds a TaskPool, see thread_pool.hpp
+{
+#endif
+
+/**
+ * A pipeline of stages working on Token objects, TBB-pipeline style.
+ *
+ *   Pipeline<Line> p;
+ *   p.parallel(parse).serial_out_of_order(count).serial_in_order(write);
+ *   p.run(read_line, 16);
+ *
+ * run() keeps at most max_tokens Token objects, made once per run and reused:
+ * the source fills a free token, the stages modify it in place, and after the last
+ * stage it goes back to the source. So items are neither copied nor allocated on the way.
+ *
+ * A serial stage runs one token at a time; serial_in_order ones also run them in the
+ * order the source produced them, parking early tokens in a reorder buffer.
+ * A thread never waits for a busy serial stage, it leaves the token to the stage's
+ * current runner and goes on with other work.
+ */
+template <typename Token>
+class Pipeline
+{
+    struct Slot
+    {
+        Token token;
+        size_t seq = 0;   // position in the input
+        size_t stage = 0; // next stage to run, stages.size() means back to the source
+    };
+
+    struct Stage
+    {
+        StageMode mode;
+        std::function<void(Token&)> fn;
+
+        std::mutex mtx;
+        bool busy = false;
+        size_t next_seq = 0;
+        std::vector<Slot*> buffer; // serial_in_order: indexed by seq; otherwise a FIFO ring
+        size_t head = 0, count = 0;
+
+        Stage(StageMode mode_, std::function<void(Token&)> fn_):mode(mode_), fn(std::move(fn_)){}
+
+        void reset(size_t tokens)
+        {
+            busy = false;
+            next_seq = head = count = 0;
+            buffer.assign(tokens, nullptr);
+        }
+        // the seqs waiting here span fewer than buffer.size() values, so they don't collide.
+        void put(Slot* s)
+        {
+            if (mode == StageMode::serial_in_order)
+                buffer[s->seq % buffer.size()] = s;
+            else
+                buffer[(head + count++) % buffer.size()] = s;
+        }
+        Slot* take()
+        {
+            Slot* s = nullptr;
+            if (mode == StageMode::serial_in_order) {
+                std::swap(s, buffer[next_seq % buffer.size()]);
+                if (s) next_seq++;
+            } else if (count) {
+                s = buffer[head];
+                head = (head + 1) % buffer.size();
+                count--;
+            }
+            return s;
+        }
+    };
+
+    std::vector<std::unique_ptr<Stage>> stages;
+
+    // state of the current run
+    Stage source_gate {StageMode::serial_out_of_order, nullptr};
+    std::function<bool(Token&)> source;
+    bool exhausted = false;
+    size_t next_seq = 0;
+    TaskPool* pool = nullptr;
+    detail::JoinCounter in_flight; // handed off, not yet finished
+    std::atomic<size_t> queued {0}; // handed off, not yet started by the pool
+    std::atomic<bool> failed {false};
+    std::mutex error_mtx;
+    std::exception_ptr error;
+
+public:
+    Pipeline() = default;
+    Pipeline(const Pipeline&) = delete;
+
+    Pipeline& add(StageMode mode, std::function<void(Token&)> fn)
+    {
+        stages.push_back(std::make_unique<Stage>(mode, std::move(fn)));
+        return *this;
+    }
+    Pipeline& parallel(std::function<void(Token&)> fn) { return add(StageMode::parallel, std::move(fn)); }
+    Pipeline& serial_in_order(std::function<void(Token&)> fn) { return add(StageMode::serial_in_order, std::move(fn)); }
+    Pipeline& serial_out_of_order(std::function<void(Token&)> fn) { return add(StageMode::serial_out_of_order, std::move(fn)); }
+
+    /**
+     * Feed tokens filled by source(token) through the stages until it returns false.
+     * source runs serially. The calling thread takes part in the work, and rethrows the
+     * first exception thrown by the source or a stage; the remaining tokens are dropped.
+     * One run at a time.
+     */
+    void run(std::function<bool(Token&)> source_, size_t max_tokens, TaskPool& pool_ = default_task_pool())
+    {
+        if (not max_tokens)
+            throw std::invalid_argument("Pipeline needs at least one token");
+        std::vector<Slot> slots(max_tokens);
+        for (auto& stage : stages) stage->reset(max_tokens);
+        source_gate.reset(max_tokens);
+        source = std::move(source_);
+        exhausted = false;
+        next_seq = 0;
+        pool = &pool_;
+        failed = false;
+        error = nullptr;
+
+        for (auto& slot : slots) source_gate.put(&slot);
+        source_gate.busy = true;
+        drive(produce(source_gate.take()));
+        in_flight.wait(*pool);
+        source = nullptr;
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    template <typename Function>
+    void call(Function&& f)
+    {
+        try {
+            if (not failed) f();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(error_mtx);
+            if (not error) error = std::current_exception();
+            failed = true;
+        }
+    }
+
+    // let another thread take slot further, or do it here if the pool is full.
+    void hand_off(Slot* slot)
+    {
+        in_flight.add();
+        queued.fetch_add(1);
+        if (pool->try_push([this, slot]() { queued.fetch_sub(1); drive(slot); in_flight.done(); }))
+            return;
+        queued.fetch_sub(1);
+        in_flight.done();
+        drive(slot);
+    }
+
+    // move slot through its remaining stages, and around through the source again.
+    void drive(Slot* slot)
+    {
+        while (slot) {
+            if (slot->stage == stages.size()) {
+                slot = arrive(source_gate, slot) ? produce(take(source_gate)) : nullptr;
+                continue;
+            }
+            Stage& stage = *stages[slot->stage];
+            if (stage.mode == StageMode::parallel) {
+                call([&]() { stage.fn(slot->token); });
+                slot->stage++;
+                continue;
+            }
+            if (not arrive(stage, slot)) return;
+            slot = take(stage);
+            while (true) {
+                call([&]() { stage.fn(slot->token); });
+                slot->stage++;
+                Slot* next = next_or_release(stage);
+                if (not next) break;
+                hand_off(slot);
+                slot = next;
+            }
+        }
+    }
+
+    // park slot at a serial stage; true if the caller became its runner.
+    bool arrive(Stage& stage, Slot* slot)
+    {
+        std::lock_guard<std::mutex> guard(stage.mtx);
+        stage.put(slot);
+        if (stage.busy) return false;
+        stage.busy = true;
+        // nothing runnable yet: an earlier token will take slot when it gets here
+        if (stage.mode == StageMode::serial_in_order && not stage.buffer[stage.next_seq % stage.buffer.size()]) {
+            stage.busy = false;
+            return false;
+        }
+        return true;
+    }
+
+    Slot* take(Stage& stage)
+    {
+        std::lock_guard<std::mutex> guard(stage.mtx);
+        return stage.take();
+    }
+
+    Slot* next_or_release(Stage& stage)
+    {
+        std::lock_guard<std::mutex> guard(stage.mtx);
+        Slot* next = stage.take();
+        if (not next) stage.busy = false;
+        return next;
+    }
+
+    // runs the source gate, starting with its first free token.
+    Slot* produce(Slot* slot)
+    {
+        while (slot) {
+            // a token handed off may still sit in the pool queue while this thread laps it
+            // with the others: run queued work first, so the source stays near the oldest token
+            if (queued.load(std::memory_order_relaxed))
+                pool->run_one();
+            bool ok = false;
+            if (not exhausted)
+                call([&]() { ok = source(slot->token); });
+            if (ok) {
+                slot->seq = next_seq++;
+                slot->stage = 0;
+            } else {
+                exhausted = true;
+            }
+            Slot* next = next_or_release(source_gate);
+            if (ok && not next) return slot;
+            if (ok) hand_off(slot);
+            slot = next;
+        }
+        return nullptr;
+    }
+};
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+}
+#endif
+
+}
+
+#endif
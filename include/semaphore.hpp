@@ -6,38 +6,266 @@
 #include <condition_variable>
 #include <atomic>
 #include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <climits>
+#include <cstdint>
+
+#ifdef __linux__
+#include <cerrno>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace oy
 {
 
+namespace detail
+{
+
+/**
+ * Futex-style parking on a 32-bit word: park() blocks while the word still holds expected,
+ * unpark() wakes threads parked on it. Wakeups may be spurious, so callers re-check in a loop.
+ * A waker changes the word before unparking; unparking a word nobody waits on
+ * (even one whose memory was reused) is harmless.
+ */
+#ifdef __linux__
+inline void park(const void* word, uint32_t expected)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+// false once deadline passed
+inline bool park_until(const void* word, uint32_t expected, std::chrono::steady_clock::time_point deadline)
+{
+    auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= left.zero()) return false;
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(left);
+    timespec ts;
+    ts.tv_sec = secs.count();
+    ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(left - secs).count();
+    return not (syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0) == -1 && errno == ETIMEDOUT);
+}
+
+inline void unpark(const void* word, int n = 1)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+#else
+// a small parking lot: words hash to a shared mutex and condition variable.
+struct ParkingBucket
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+inline ParkingBucket& parking_bucket(const void* word)
+{
+    static ParkingBucket table[64];
+    return table[(reinterpret_cast<uintptr_t>(word) >> 4) % 64];
+}
+
+inline uint32_t load_word(const void* word)
+{
+    return __atomic_load_n(static_cast<const uint32_t*>(word), __ATOMIC_SEQ_CST);
+}
+
+inline void park(const void* word, uint32_t expected)
+{
+    ParkingBucket& b = parking_bucket(word);
+    std::unique_lock<std::mutex> lock(b.mtx);
+    if (load_word(word) == expected)
+        b.cv.wait(lock);
+}
+
+inline bool park_until(const void* word, uint32_t expected, std::chrono::steady_clock::time_point deadline)
+{
+    ParkingBucket& b = parking_bucket(word);
+    std::unique_lock<std::mutex> lock(b.mtx);
+    if (load_word(word) != expected) return true;
+    return b.cv.wait_until(lock, deadline) == std::cv_status::no_timeout;
+}
+
+inline void unpark(const void* word, int = 1)
+{
+    ParkingBucket& b = parking_bucket(word);
+    { std::lock_guard<std::mutex> guard(b.mtx); }
+    b.cv.notify_all();
+}
+#endif
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// the 32-bit halves of a 64-bit atomic, to park on one half while updating both at once
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "parking on half of a 64-bit atomic");
+inline const void* low_half(const std::atomic<uint64_t>* word)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return word;
+#else
+    return reinterpret_cast<const uint32_t*>(word) + 1;
+#endif
+}
+inline const void* high_half(const std::atomic<uint64_t>* word)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return reinterpret_cast<const uint32_t*>(word) + 1;
+#else
+    return word;
+#endif
+}
+
+}
+
+/**
+ * A counting semaphore taking and giving any number of units at once.
+ *
+ * Waiters queue in FIFO order, each for all the units it asked for: a waiter never holds
+ * part of its units, and a small request does not overtake a larger one queued before it.
+ * release(n) hands units to the head of the queue while they suffice, and wakes only those
+ * waiters, each parked on a word in its own queue node.
+ */
 class Semaphore {
 public:
     Semaphore (int count_ = 0)
         : count(count_) {}
+    Semaphore(const Semaphore&) = delete;
+    ~Semaphore()
+    {
+        while (head) {
+            Waiter* w = head;
+            unlink(w);
+            delete w; // only callbacks are still queued
+        }
+    }
 
-    inline void notify()
+    inline void release(int n = 1)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        count++;
-        cv.notify_one();
+        if (n < 0) throw std::invalid_argument("Semaphore::release: negative count");
+        Waiter* ready = nullptr;
+        Waiter** last = &ready;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            count += n;
+            while (head && head->needed <= count) {
+                Waiter* w = head;
+                count -= w->needed;
+                unlink(w);
+                *last = w;
+                last = &w->next;
+            }
+        }
+        // wake the blocked waiters before running any callback, which may throw.
+        // granted waiters may return as soon as they see it: read next first, then only wake
+        Waiter* callbacks = nullptr;
+        last = &callbacks;
+        while (ready) {
+            Waiter* w = ready;
+            ready = w->next;
+            if (w->callback) {
+                *last = w;
+                last = &w->next;
+                *last = nullptr;
+            } else {
+                w->granted.store(1);
+                detail::unpark(&w->granted);
+            }
+        }
+        // every callback runs, its units are taken; the first exception is rethrown after them
+        std::exception_ptr error;
+        while (callbacks) {
+            std::unique_ptr<Waiter> w(callbacks);
+            callbacks = w->next;
+            try {
+                w->callback();
+            } catch (...) {
+                if (not error) error = std::current_exception();
+            }
+        }
+        if (error) std::rethrow_exception(error);
     }
 
-    inline void wait()
+    inline void acquire(int n = 1)
+    {
+        Waiter w(n);
+        if (not try_take_or_enqueue(&w))
+            park(w);
+    }
+
+    inline bool try_acquire(int n = 1)
     {
+        if (n < 0) throw std::invalid_argument("Semaphore::try_acquire: negative count");
         std::unique_lock<std::mutex> lock(mtx);
+        if (head || count < n) return false;
+        count -= n;
+        return true;
+    }
 
-        while(count == 0){
-            cv.wait(lock);
-        }
-        count--;
+    template <typename Duration>
+    bool try_acquire_for(int n, const Duration duration)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration);
+        Waiter w(n);
+        if (try_take_or_enqueue(&w)) return true;
+        while (w.granted.load() == 0)
+            if (not detail::park_until(&w.granted, 0, deadline)) {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (not w.queued) break; // granted meanwhile
+                unlink(&w);
+                // the units w waited for may now suffice for those behind it
+                Waiter* next = head;
+                lock.unlock();
+                if (next) release(0);
+                return false;
+            }
+        park(w);
+        return true;
     }
+
+    inline void notify() { release(1); }
+    inline void wait() { acquire(1); }
+    inline bool try_wait() { return try_acquire(1); }
+    // true once a unit can be had within duration; like before, wait_for does not keep it
     template <typename Duration>
     bool wait_for(const Duration duration)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        auto wait_for_it_success = cv.wait_for(lock, duration, [this]() { return count > 0; });
-        return wait_for_it_success;
+        if (not try_acquire_for(1, duration)) return false;
+        release(1);
+        return true;
+    }
+
+    /**
+     * Take a unit without blocking: on_acquire runs once it is taken,
+     * either right away on this thread or later on the thread calling release().
+     * It queues with the blocked waiters, in the same order.
+     */
+    inline void async_wait(std::function<void()> on_acquire)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (head || count == 0) {
+                Waiter* w = new Waiter(1);
+                w->callback = std::move(on_acquire);
+                enqueue(w);
+                return;
+            }
+            count--;
+        }
+        on_acquire();
     }
+
     inline void reset()
     {
         if(mtx.try_lock())
@@ -52,57 +280,309 @@ public:
     }
 
 private:
-    std::mutex mtx;
-    std::condition_variable cv;
+    struct Waiter
+    {
+        explicit Waiter(int needed_):needed(needed_){}
+        int needed;
+        bool queued = false;
+        std::atomic<uint32_t> granted {0};
+        std::function<void()> callback; // for async_wait, instead of parking
+        Waiter* prev = nullptr;
+        Waiter* next = nullptr;
+    };
+
+    std::mutex mtx; // guards count and the queue, never held while parked
     int count;
+    Waiter* head = nullptr;
+    Waiter* tail = nullptr;
+
+    bool try_take_or_enqueue(Waiter* w)
+    {
+        if (w->needed < 0) throw std::invalid_argument("Semaphore::acquire: negative count");
+        std::unique_lock<std::mutex> lock(mtx);
+        if (not head && count >= w->needed) {
+            count -= w->needed;
+            return true;
+        }
+        enqueue(w);
+        return false;
+    }
+
+    static void park(Waiter& w)
+    {
+        while (w.granted.load() == 0)
+            detail::park(&w.granted, 0);
+    }
+
+    void enqueue(Waiter* w)
+    {
+        w->queued = true;
+        w->prev = tail;
+        if (tail) tail->next = w;
+        else head = w;
+        tail = w;
+    }
+
+    void unlink(Waiter* w)
+    {
+        if (w->prev) w->prev->next = w->next;
+        else head = w->next;
+        if (w->next) w->next->prev = w->prev;
+        else tail = w->prev;
+        w->prev = w->next = nullptr;
+        w->queued = false;
+    }
 };
 
-// TODO: has BUG when unsigned long long overflow
-class Semaphore_chronological {
+/**
+ * Semaphore without a mutex: notify() and an uncontended wait() are a single atomic operation.
+ * A waiter spins a little, then parks on the count (futex on Linux).
+ *
+ * The count and the number of parked waiters share one 64-bit word, so notify() never touches
+ * the object after its increment: a waiter may return and destroy a semaphore living on its
+ * stack while the notifying thread is still inside notify().
+ */
+class LightSemaphore {
 public:
-    // constexpr unsigned long long int MAX_SEM_WAIT = 123456789;
-    Semaphore_chronological (unsigned long long int count_ = 0) : notify_turn(count_){}
+    static constexpr int SpinCount = 64;
 
-    void notify()
+    LightSemaphore (uint32_t count_ = 0)
+        : state(count_) {}
+    LightSemaphore(const LightSemaphore&) = delete;
+
+    inline void notify()
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        //count++;
-        notify_turn++;
-        cv.notify_all();
+        if (state.fetch_add(1) >> 32)
+            detail::unpark(count_word());
     }
 
-    void wait()
+    inline bool try_wait()
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        unsigned int my_wait_turn = wait_turn++;
-        cv.wait(lock, [this, my_wait_turn]()
-                { // TODO: BUG: fix this when unsigned long long overflow
-                    return my_wait_turn <= notify_turn;
-                });
+        uint64_t s = state.load();
+        while (uint32_t(s) != 0)
+            if (state.compare_exchange_weak(s, s - 1))
+                return true;
+        return false;
     }
+
+    inline void wait()
+    {
+        if (spin()) return;
+        state.fetch_add(one_waiter);
+        while (not try_leave())
+            detail::park(count_word(), 0);
+    }
+
     template <typename Duration>
     bool wait_for(const Duration duration)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        unsigned int my_wait_turn = wait_turn++;
-        auto wait_for_it_success = cv.wait_for(lock, duration, [this, my_wait_turn]()
-                { // TODO: BUG: fix this when unsigned long long overflow
-                    return my_wait_turn <= notify_turn;
-                });
-        if (!wait_for_it_success)
-        {
-            notify_turn++;
-            cv.notify_all();
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration);
+        if (spin()) return true;
+        state.fetch_add(one_waiter);
+        while (not try_leave()) {
+            if (not detail::park_until(count_word(), 0, deadline)) {
+                if (try_leave()) return true;
+                state.fetch_sub(one_waiter);
+                return false;
+            }
         }
-        return wait_for_it_success;
+        return true;
     }
+
+    // current count, for diagnostics
+    inline uint32_t value() const { return uint32_t(state.load()); }
+
+    inline void reset()
+    {
+        uint64_t s = state.load();
+        while (not state.compare_exchange_weak(s, s & ~uint64_t(0xffffffff)));
+    }
+
 private:
-    std::mutex mtx;
-    std::condition_variable cv;
-    unsigned long long int wait_turn = 1;
-    unsigned long long int notify_turn = 0;
+    static constexpr uint64_t one_waiter = uint64_t(1) << 32;
+
+    // low half: count, high half: parked waiters
+    std::atomic<uint64_t> state;
+
+    const void* count_word() const { return detail::low_half(&state); }
+
+    bool spin()
+    {
+        for (int i = 0; i < SpinCount; i++) {
+            if (try_wait()) return true;
+            detail::cpu_relax();
+        }
+        return false;
+    }
+
+    // take a unit and stop being a waiter in one step
+    bool try_leave()
+    {
+        uint64_t s = state.load();
+        while (uint32_t(s) != 0)
+            if (state.compare_exchange_weak(s, s - 1 - one_waiter))
+                return true;
+        return false;
+    }
+};
+
+/**
+ * A fair semaphore: units go to waiters in the order they started waiting.
+ * Semaphore queues its waiters that way; this is its one-unit interface.
+ */
+class Semaphore_chronological {
+public:
+    Semaphore_chronological (unsigned long long int count_ = 0) : sem(checked(count_)){}
+    Semaphore_chronological(const Semaphore_chronological&) = delete;
+
+    void notify() { sem.release(1); }
+    void wait() { sem.acquire(1); }
+    template <typename Duration>
+    bool wait_for(const Duration duration) { return sem.try_acquire_for(1, duration); }
+
+private:
+    Semaphore sem;
+
+    static int checked(unsigned long long int count)
+    {
+        if (count > static_cast<unsigned long long int>(INT_MAX))
+            throw std::invalid_argument("Semaphore_chronological: count out of range");
+        return static_cast<int>(count);
+    }
+};
+
+/**
+ * A one-shot countdown: wait() blocks until count_down() was called count times in total.
+ */
+class Latch {
+public:
+    explicit Latch(uint32_t count) : remaining(count) {}
+    Latch(const Latch&) = delete;
+
+    // throw std::invalid_argument if n is more than the count left
+    void count_down(uint32_t n = 1)
+    {
+        uint32_t v = remaining.load();
+        do {
+            if (n > v) throw std::invalid_argument("Latch::count_down: n exceeds the remaining count");
+        } while (not remaining.compare_exchange_weak(v, v - n));
+        if (v == n)
+            detail::unpark(&remaining, INT_MAX);
+    }
+
+    bool try_wait() const { return remaining.load() == 0; }
+
+    void wait() const
+    {
+        uint32_t v;
+        while ((v = remaining.load()) != 0)
+            detail::park(&remaining, v);
+    }
+
+    void arrive_and_wait(uint32_t n = 1)
+    {
+        count_down(n);
+        wait();
+    }
+
+private:
+    std::atomic<uint32_t> remaining;
+};
+
+/**
+ * A reusable barrier for a fixed number of threads. Each phase ends when all of them
+ * called arrive_and_wait(); the last one to arrive runs completion, if any, before
+ * the others are released into the next phase.
+ */
+class Barrier {
+public:
+    explicit Barrier(uint32_t count_, std::function<void()> completion_ = nullptr)
+        : count(count_), completion(std::move(completion_))
+    {
+        if (count == 0) throw std::invalid_argument("Barrier needs at least one thread");
+    }
+    Barrier(const Barrier&) = delete;
+
+    void arrive_and_wait()
+    {
+        // the phase cannot move on before this thread arrives
+        uint32_t ph = phase.load();
+        if (arrived.fetch_add(1) + 1 == count) {
+            if (completion) completion();
+            arrived.store(0);
+            phase.fetch_add(1);
+            detail::unpark(&phase, INT_MAX);
+            return;
+        }
+        while (phase.load() == ph)
+            detail::park(&phase, ph);
+    }
+
+private:
+    const uint32_t count;
+    std::function<void()> completion;
+    std::atomic<uint32_t> arrived {0};
+    std::atomic<uint32_t> phase {0};
+};
+
+/**
+ * Lets a thread sleep until a condition, checked without locks, may have become true.
+ * The consumer side:
+ *
+ *   while (not queue.try_pop(x)) {
+ *       auto key = ec.prepare_wait();
+ *       if (queue.try_pop(x)) { ec.cancel_wait(); break; }
+ *       ec.commit_wait(key);
+ *   }
+ *
+ * and the producer calls notify() after making the condition true. notify() costs
+ * one fence and one load when nobody waits.
+ */
+class EventCount {
+public:
+    using Key = uint32_t;
+
+    EventCount() = default;
+    EventCount(const EventCount&) = delete;
+
+    Key prepare_wait()
+    {
+        return Key(state.fetch_add(one_waiter) >> 32);
+    }
+
+    void cancel_wait()
+    {
+        state.fetch_sub(one_waiter);
+    }
+
+    // sleep until a notify() after the prepare_wait() returning key
+    void commit_wait(Key key)
+    {
+        while (Key(state.load() >> 32) == key)
+            detail::park(detail::high_half(&state), key);
+        state.fetch_sub(one_waiter);
+    }
+
+    void notify() { wake(1); }
+    void notify_all() { wake(INT_MAX); }
+
+private:
+    static constexpr uint64_t one_waiter = 1;
+    static constexpr uint64_t one_epoch = uint64_t(1) << 32;
+
+    // low half: threads between prepare_wait and the end of their wait, high half: epoch
+    std::atomic<uint64_t> state {0};
+
+    void wake(int n)
+    {
+        // orders the caller's update of the condition before the waiter count is read
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (uint32_t(state.load()) == 0) return;
+        state.fetch_add(one_epoch);
+        detail::unpark(detail::high_half(&state), n);
+    }
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
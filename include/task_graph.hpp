@@ -0,0 +1,222 @@
+#ifndef _GITHUB_SCINART_CPPLIB_TASK_GRAPH_HPP_
+#define _GITHUB_SCINART_CPPLIB_TASK_GRAPH_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "parallel.hpp"
+
+namespace oy
+{
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+inline namespace distributor_metrics // TaskGraph holds a TaskPool, see thread_pool.hpp
+{
+#endif
+
+/**
+ * A DAG of tasks, built once and run any number of times on a TaskPool.
+ *
+ *   TaskGraph g;
+ *   auto a = g.add("shard a", build_a);
+ *   auto b = g.add("shard b", build_b);
+ *   auto m = g.add("merge", merge, {a, b});
+ *   g.run(pool);
+ *
+ * Each node counts its unfinished predecessors; the one finishing last releases it.
+ * The first released successor continues on the same thread, the others go to the pool.
+ * Every run records per-node timings, and the critical path through them.
+ */
+class TaskGraph
+{
+public:
+    using Node = size_t;
+    using clock = std::chrono::steady_clock;
+
+    struct Timing
+    {
+        std::chrono::nanoseconds start, finish; // since the run began
+        std::chrono::nanoseconds duration() const { return finish - start; }
+    };
+
+    TaskGraph() = default;
+    TaskGraph(const TaskGraph&) = delete;
+
+    Node add(std::string name, std::function<void()> fn, std::initializer_list<Node> after = {})
+    {
+        nodes.push_back(NodeData{std::move(name), std::move(fn), {}, {}});
+        Node n = nodes.size() - 1;
+        for (Node before : after)
+            precede(before, n);
+        return n;
+    }
+
+    // after runs once before has finished.
+    void precede(Node before, Node after)
+    {
+        if (before >= nodes.size() || after >= nodes.size())
+            throw std::out_of_range("TaskGraph: no such node");
+        nodes[before].successors.push_back(after);
+        nodes[after].predecessors.push_back(before);
+        order.clear();
+    }
+
+    size_t size() const { return nodes.size(); }
+    const std::string& name(Node n) const { return nodes.at(n).name; }
+
+    /**
+     * Run every node once. The calling thread takes part in the work.
+     * After the first exception, the nodes not started yet are skipped, and it is rethrown here.
+     * throw std::logic_error if the graph has a cycle.
+     */
+    void run(TaskPool& pool_ = default_task_pool())
+    {
+        if (order.size() != nodes.size())
+            sort();
+        pool = &pool_;
+        remaining.reset(new std::atomic<size_t>[nodes.size()]);
+        for (Node n = 0; n < nodes.size(); n++)
+            remaining[n] = nodes[n].predecessors.size();
+        timings.assign(nodes.size(), Timing{});
+        unfinished.add(nodes.size());
+        failed = false;
+        error = nullptr;
+        started = clock::now();
+
+        for (Node n = 0; n < nodes.size(); n++)
+            if (nodes[n].predecessors.empty())
+                release(n);
+        unfinished.wait(*pool);
+        wall = clock::now() - started;
+        if (error) std::rethrow_exception(error);
+    }
+
+    // of the last run
+    const Timing& timing(Node n) const { return timings.at(n); }
+    std::chrono::nanoseconds elapsed() const { return wall; }
+
+    /**
+     * The chain of dependent nodes with the largest summed duration in the last run:
+     * no schedule can finish faster than it.
+     */
+    std::vector<Node> critical_path() const
+    {
+        if (timings.size() != nodes.size() || nodes.empty()) return {};
+        std::vector<std::chrono::nanoseconds> longest(nodes.size());
+        std::vector<Node> via(nodes.size(), nodes.size());
+        for (Node n : order) {
+            longest[n] = timings[n].duration();
+            for (Node p : nodes[n].predecessors)
+                if (longest[p] + timings[n].duration() > longest[n]) {
+                    longest[n] = longest[p] + timings[n].duration();
+                    via[n] = p;
+                }
+        }
+        Node last = std::max_element(longest.begin(), longest.end()) - longest.begin();
+        std::vector<Node> path;
+        for (Node n = last; n != nodes.size(); n = via[n])
+            path.push_back(n);
+        std::reverse(path.begin(), path.end());
+        return path;
+    }
+
+    std::chrono::nanoseconds critical_path_length() const
+    {
+        std::chrono::nanoseconds total {0};
+        for (Node n : critical_path())
+            total += timings[n].duration();
+        return total;
+    }
+
+private:
+    struct NodeData
+    {
+        std::string name;
+        std::function<void()> fn;
+        std::vector<Node> successors;
+        std::vector<Node> predecessors;
+    };
+
+    std::vector<NodeData> nodes;
+    std::vector<Node> order; // topological, empty when the graph changed
+
+    // state of the current run
+    TaskPool* pool = nullptr;
+    std::unique_ptr<std::atomic<size_t>[]> remaining;
+    detail::JoinCounter unfinished;
+    std::atomic<bool> failed {false};
+    std::mutex error_mtx;
+    std::exception_ptr error;
+    clock::time_point started;
+    std::chrono::nanoseconds wall {0};
+    std::vector<Timing> timings;
+
+    // Kahn's algorithm, also checks the graph for cycles.
+    void sort()
+    {
+        std::vector<size_t> indegree(nodes.size());
+        order.clear();
+        for (Node n = 0; n < nodes.size(); n++)
+            if ((indegree[n] = nodes[n].predecessors.size()) == 0)
+                order.push_back(n);
+        for (size_t i = 0; i < order.size(); i++)
+            for (Node s : nodes[order[i]].successors)
+                if (--indegree[s] == 0)
+                    order.push_back(s);
+        if (order.size() != nodes.size()) {
+            order.clear();
+            throw std::logic_error("TaskGraph has a cycle");
+        }
+    }
+
+    void release(Node n)
+    {
+        if (not pool->try_push([this, n]() { execute(n); }))
+            execute(n);
+    }
+
+    void execute(Node n)
+    {
+        while (true) {
+            timings[n].start = clock::now() - started;
+            if (not failed) {
+                try {
+                    nodes[n].fn();
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(error_mtx);
+                    if (not error) error = std::current_exception();
+                    failed = true;
+                }
+            }
+            timings[n].finish = clock::now() - started;
+
+            Node next = nodes.size();
+            for (Node s : nodes[n].successors)
+                if (remaining[s].fetch_sub(1) == 1) {
+                    if (next == nodes.size()) next = s;
+                    else release(s);
+                }
+            bool done = next == nodes.size();
+            unfinished.done(); // run() may return right after: the graph is not touched below
+            if (done) return;
+            n = next;
+        }
+    }
+};
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+}
+#endif
+
+}
+
+#endif
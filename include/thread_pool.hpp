@@ -4,25 +4,147 @@
 // source: https://github.com/mlang/wikiwordfreq
 // modified my be
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "affinity.hpp"
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+#include "histogram.hpp"
+#endif
+
 namespace oy
 {
 
+/**
+ * Worker bounds of an elastic Distributor.
+ * A worker is added on push when none is idle and either spawn_depth items are queued,
+ * or nothing was dequeued for spawn_wait. A worker idle for idle_timeout retires.
+ */
+struct Elastic
+{
+    unsigned int min_workers = 1;
+    unsigned int max_workers = std::thread::hardware_concurrency();
+    size_t spawn_depth = 4;
+    std::chrono::milliseconds spawn_wait {10};
+    std::chrono::milliseconds idle_timeout {1000};
+};
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+/**
+ * What a Distributor has been doing, see Distributor::snapshot().
+ * Durations are in nanoseconds.
+ */
+struct DistributorStats
+{
+    struct Worker
+    {
+        uint64_t items, busy_ns, idle_ns;
+        double busy_ratio() const { return busy_ns + idle_ns ? double(busy_ns) / (busy_ns + idle_ns) : 0; }
+    };
+    LogHistogram wait_ns;    // enqueue to dequeue
+    LogHistogram service_ns; // inside the processing function
+    uint64_t blocked_pushes = 0; // pushes which found the queue full
+    uint64_t blocked_ns = 0;     // time producers waited for room
+    size_t depth = 0;
+    unsigned int workers = 0;
+    std::vector<Worker> per_worker; // live workers
+    Worker retired {0, 0, 0};       // the workers which exited, added up
+};
+#endif
+
+namespace detail
+{
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+inline namespace distributor_metrics
+{
+// written by its worker only, read by snapshot()
+struct WorkerMetrics
+{
+    LogHistogram wait_ns;
+    LogHistogram service_ns;
+    std::atomic<uint64_t> items {0};
+    std::atomic<uint64_t> busy_ns {0};
+    std::atomic<uint64_t> idle_ns {0};
+    std::atomic<int64_t> idle_since {0}; // steady_clock ticks when the current wait began, 0 when busy
+
+    void begin_idle(std::chrono::steady_clock::time_point t0) { idle_since.store(t0.time_since_epoch().count()); }
+    void end_idle(uint64_t ns)
+    {
+        idle_since.store(0);
+        idle_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+};
+}
+#else
+using WorkerMetrics = void;
+#endif
+
+// items of non-FIFO queues carry their enqueue time, see Prioritized
+template <typename T, typename = void> struct has_enqueued_stamp : std::false_type {};
+template <typename T> struct has_enqueued_stamp<T, decltype(void(std::declval<T&>().enqueued))> : std::true_type {};
+
+// queues which bound each lane on its own provide full(item, capacity), see PriorityLanes
+template <typename Queue, typename T, typename = void> struct has_lane_capacity : std::false_type {};
+template <typename Queue, typename T>
+struct has_lane_capacity<Queue, T, decltype(void(std::declval<const Queue&>().full(std::declval<const T&>(), size_t())))>
+    : std::true_type {};
+
+struct DropExpired { template <typename T> void operator()(T&&) const {} };
+}
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+// Distributor changes layout with metrics: keep instrumented and plain translation units apart
+inline namespace distributor_metrics
+{
+#endif
+
 /**
  * Thread Pool of function signature void(*)(T)
+ *
+ * Define SCINART_CPPLIB_DISTRIBUTOR_METRICS to record queue wait and service time
+ * histograms, producer blocking and worker busy time, see snapshot().
  */
 
 template <typename Type, typename Queue = std::queue<std::remove_reference_t<Type>>>
 class Distributor: Queue, std::mutex, std::condition_variable {
+    using clock = std::chrono::steady_clock;
+
     typename Queue::size_type capacity;
     bool done = false;
     std::vector<std::thread> threads;
+    std::vector<std::thread::id> exited;
+    std::vector<int> cpus;
+    size_t next_cpu = 0;
+    std::function<void(int, detail::WorkerMetrics*)> worker;
+
+    std::atomic<size_t> depth {0}; // Queue::size(), for pending() without the lock
+    unsigned int workers = 0;  // started and not exited
+    unsigned int idle = 0;     // waiting for an item
+    unsigned int retiring = 0; // asked to exit by resize()
+    bool elastic = false;
+    Elastic bounds;
+    clock::time_point last_dequeue = clock::now();
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+    std::vector<std::unique_ptr<detail::WorkerMetrics>> metrics;
+    std::queue<clock::time_point> stamps; // enqueue times, when items do not carry one
+    LogHistogram inline_wait_ns;          // items taken by try_pop
+    LogHistogram retired_wait_ns, retired_service_ns;
+    DistributorStats::Worker retired {0, 0, 0};
+    uint64_t blocked_pushes = 0;
+    uint64_t blocked_ns = 0;
+#endif
 
 public:
     template<typename Function>
@@ -36,9 +158,47 @@ public:
         if (not capacity)
             throw std::invalid_argument("Queue capacity must be non-zero");
 
-        for (unsigned int count {0}; count < concurrency; count += 1)
-            threads.emplace_back(static_cast<void (Distributor::*)(Function)>
-                                 (&Distributor::consume), this, function);
+        start(function, concurrency);
+    }
+
+    /**
+     * One worker per cpu of placement, pinned to it.
+     * Each pinned worker makes its own copy of function after pinning,
+     * so state allocated by that copy is first touched on the worker's NUMA node.
+     */
+    template<typename Function>
+    Distributor( Function function,
+                 const Placement& placement,
+                 typename Queue::size_type capacity_ = std::thread::hardware_concurrency())
+        :capacity(capacity_), cpus(placement.cpus)
+    {
+        if (cpus.empty())
+            throw std::invalid_argument("Placement must name at least one cpu");
+        if (not capacity)
+            throw std::invalid_argument("Queue capacity must be non-zero");
+        auto allowed = allowed_cpus();
+        for (int cpu : cpus)
+            if (std::find(allowed.begin(), allowed.end(), cpu) == allowed.end())
+                throw std::invalid_argument("cpu " + std::to_string(cpu) + " is not available");
+
+        start(function, cpus.size());
+    }
+
+    /**
+     * Starts with bounds.min_workers, and grows or shrinks with the queue pressure.
+     */
+    template<typename Function>
+    Distributor( Function function,
+                 const Elastic& bounds_,
+                 typename Queue::size_type capacity_ = std::thread::hardware_concurrency())
+        :capacity(capacity_), elastic(true), bounds(bounds_)
+    {
+        if (not bounds.min_workers || bounds.min_workers > bounds.max_workers)
+            throw std::invalid_argument("Worker bounds must satisfy 0 < min_workers <= max_workers");
+        if (not capacity)
+            throw std::invalid_argument("Queue capacity must be non-zero");
+
+        start(function, bounds.min_workers);
     }
 
     Distributor(Distributor &&) = default;
@@ -58,33 +218,474 @@ public:
     void operator()(T &&value)
     {
         std::unique_lock<std::mutex> lock(*this);
-        while (Queue::size() == capacity) wait(lock);
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+        bool blocked = full(value);
+        auto t0 = blocked ? clock::now() : clock::time_point();
+#endif
+        while (full(value)) {
+            grow();
+            wait(lock);
+        }
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+        if (blocked) {
+            blocked_pushes++;
+            blocked_ns += since(t0);
+        }
+#endif
+        Queue::emplace(std::forward<T>(value));
+        depth.store(Queue::size(), std::memory_order_relaxed);
+        stamp(detail::has_enqueued_stamp<std::remove_reference_t<Type>>());
+        notify_one();
+        grow();
+    }
+
+    /**
+     * Like operator(), but returns false instead of waiting when the queue is full.
+     */
+    template <typename T>
+    bool try_push(T &&value)
+    {
+        std::lock_guard<std::mutex> guard(*this);
+        if (full(value)) return false;
         Queue::emplace(std::forward<T>(value));
+        depth.store(Queue::size(), std::memory_order_relaxed);
+        stamp(detail::has_enqueued_stamp<std::remove_reference_t<Type>>());
         notify_one();
+        grow();
+        return true;
     }
 
+    /**
+     * Take a queued item away from the workers, so the caller can process it itself.
+     */
+    bool try_pop(std::remove_reference_t<Type> &item)
+    {
+        std::lock_guard<std::mutex> guard(*this);
+        if (Queue::empty()) return false;
+        item = std::move(Queue::front());
+        Queue::pop();
+        depth.store(Queue::size(), std::memory_order_relaxed);
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+        inline_wait_ns.record(waited(item, detail::has_enqueued_stamp<std::remove_reference_t<Type>>()));
+#endif
+        notify_dequeued();
+        return true;
+    }
+
+    // a relaxed read, cheap enough for splitting decisions; may lag a concurrent push or pop
+    typename Queue::size_type pending() const
+    {
+        return depth.load(std::memory_order_relaxed);
+    }
+
+    unsigned int concurrency()
+    {
+        std::lock_guard<std::mutex> guard(*this);
+        return workers - retiring;
+    }
+
+    /**
+     * Change the number of workers.
+     * Retiring workers finish their current item first; queued items stay for the others.
+     */
+    void resize(unsigned int n)
+    {
+        if (not n)
+            throw std::invalid_argument("Concurrency must be non-zero");
+        if (elastic && (n < bounds.min_workers || n > bounds.max_workers))
+            throw std::invalid_argument("Concurrency out of the elastic bounds");
+
+        std::lock_guard<std::mutex> guard(*this);
+        reap();
+        unsigned int live = workers - retiring;
+        if (n > live) {
+            unsigned int kept = std::min(retiring, n - live);
+            retiring -= kept;
+            for (live += kept; live < n; live++) spawn();
+        } else if (n < live) {
+            retiring += live - n;
+            notify_all();
+        }
+    }
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+    DistributorStats snapshot()
+    {
+        std::lock_guard<std::mutex> guard(*this);
+        DistributorStats stats;
+        stats.depth = Queue::size();
+        stats.workers = workers - retiring;
+        stats.blocked_pushes = blocked_pushes;
+        stats.blocked_ns = blocked_ns;
+        stats.wait_ns.merge(inline_wait_ns);
+        stats.wait_ns.merge(retired_wait_ns);
+        stats.service_ns.merge(retired_service_ns);
+        stats.retired = retired;
+        for (auto& m : metrics) {
+            stats.wait_ns.merge(m->wait_ns);
+            stats.service_ns.merge(m->service_ns);
+            uint64_t idle_ns = m->idle_ns.load();
+            if (auto t0 = m->idle_since.load()) // count the wait in progress too
+                idle_ns += since(clock::time_point(clock::duration(t0)));
+            stats.per_worker.push_back({m->items.load(), m->busy_ns.load(), idle_ns});
+        }
+        return stats;
+    }
+#endif
+
 private:
     template <typename Function>
-    void consume(Function process)
+    void start(Function function, unsigned int concurrency)
+    {
+        worker = [this, function](int cpu, detail::WorkerMetrics* m) { consume(function, cpu, m); };
+        std::lock_guard<std::mutex> guard(*this);
+        for (unsigned int count {0}; count < concurrency; count += 1)
+            spawn();
+    }
+
+    // with the lock held
+    void spawn()
+    {
+        detail::WorkerMetrics* m = nullptr;
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+        metrics.push_back(std::make_unique<detail::WorkerMetrics>());
+        m = metrics.back().get();
+#endif
+        threads.emplace_back(worker, cpus.empty() ? -1 : cpus[next_cpu++ % cpus.size()], m);
+        workers++;
+    }
+
+    // with the lock held: join the threads which already exited.
+    void reap()
+    {
+        for (auto id : exited) {
+            auto it = std::find_if(threads.begin(), threads.end(), [id](const std::thread& t) { return t.get_id() == id; });
+            it->join();
+            threads.erase(it);
+        }
+        exited.clear();
+    }
+
+    // with the lock held
+    void grow()
+    {
+        if (not elastic || done || idle != 0 || Queue::empty() || workers - retiring >= bounds.max_workers)
+            return;
+        if (Queue::size() >= bounds.spawn_depth || clock::now() - last_dequeue >= bounds.spawn_wait) {
+            reap();
+            spawn();
+            last_dequeue = clock::now();
+        }
+    }
+
+    // with the lock held: whether value has to wait for room
+    template <typename T>
+    bool full(const T& value) const { return full(value, detail::has_lane_capacity<Queue, T>()); }
+    template <typename T>
+    bool full(const T&, std::false_type) const { return Queue::size() == capacity; }
+    template <typename T>
+    bool full(const T& value, std::true_type) const { return Queue::full(value, capacity); }
+
+    // with the lock held. The freed room may belong to any lane, so with lanes every blocked producer rechecks.
+    void notify_dequeued()
+    {
+        if (detail::has_lane_capacity<Queue, std::remove_reference_t<Type>>::value)
+            notify_all();
+        else
+            notify_one();
+    }
+
+    // with the lock held
+    void stamp(std::true_type) {}
+    void stamp(std::false_type)
+    {
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+        stamps.push(clock::now());
+#endif
+    }
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+    static uint64_t since(clock::time_point t0)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+    }
+    // with the lock held: fold the metrics of an exiting worker into the totals and free its slot
+    void retire(detail::WorkerMetrics* m)
+    {
+        retired_wait_ns.merge(m->wait_ns);
+        retired_service_ns.merge(m->service_ns);
+        retired.items += m->items.load();
+        retired.busy_ns += m->busy_ns.load();
+        retired.idle_ns += m->idle_ns.load();
+        metrics.erase(std::find_if(metrics.begin(), metrics.end(), [m](const auto& p) { return p.get() == m; }));
+    }
+    // with the lock held, right after item was dequeued
+    template <typename Item>
+    uint64_t waited(const Item& item, std::true_type) { return since(item.enqueued); }
+    template <typename Item>
+    uint64_t waited(const Item&, std::false_type)
+    {
+        auto t0 = stamps.front();
+        stamps.pop();
+        return since(t0);
+    }
+#endif
+
+    template <typename Function>
+    void consume(Function process, int cpu, detail::WorkerMetrics* m)
+    {
+        if (cpu >= 0 && pin_this_thread(cpu)) {
+            Function local(process);
+            run(local, m);
+        } else {
+            run(process, m);
+        }
+    }
+
+    template <typename Function>
+    void run(Function& process, detail::WorkerMetrics* m)
     {
+        (void)m;
         std::unique_lock<std::mutex> lock(*this);
         while (true) {
-            if (not Queue::empty()) {
+            if (retiring) {
+                retiring--;
+                break;
+            } else if (not Queue::empty()) {
                 std::remove_reference_t<Type> item { std::move(Queue::front()) };
                 Queue::pop();
-                notify_one();
+                depth.store(Queue::size(), std::memory_order_relaxed);
+                last_dequeue = clock::now();
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+                m->wait_ns.record(waited(item, detail::has_enqueued_stamp<std::remove_reference_t<Type>>()));
+#endif
+                notify_dequeued();
                 lock.unlock();
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+                auto t0 = clock::now();
                 process(std::forward<Type>(item));
+                auto ns = since(t0);
+                m->service_ns.record(ns);
+                m->busy_ns.fetch_add(ns, std::memory_order_relaxed);
+                m->items.fetch_add(1, std::memory_order_relaxed);
+#else
+                process(std::forward<Type>(item));
+#endif
                 lock.lock();
             } else if (done) {
                 break;
+            } else if (elastic) {
+                idle++;
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+                auto t0 = clock::now();
+                m->begin_idle(t0);
+                auto status = wait_until(lock, t0 + bounds.idle_timeout);
+                m->end_idle(since(t0));
+#else
+                auto status = wait_until(lock, clock::now() + bounds.idle_timeout);
+#endif
+                idle--;
+                if (status == std::cv_status::timeout && Queue::empty() && not done
+                    && workers - retiring > bounds.min_workers)
+                    break;
             } else {
+                idle++;
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+                auto t0 = clock::now();
+                m->begin_idle(t0);
+                wait(lock);
+                m->end_idle(since(t0));
+#else
                 wait(lock);
+#endif
+                idle--;
             }
         }
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+        retire(m);
+#endif
+        workers--;
+        exited.push_back(std::this_thread::get_id());
     }
 };
 
+/**
+ * An item of PriorityDistributor.
+ * lane 0 is the most urgent; within a lane, earliest deadline first, then FIFO.
+ */
+template <typename T>
+struct Prioritized
+{
+    using clock = std::chrono::steady_clock;
+    T value;
+    unsigned int lane = 0;
+    clock::time_point deadline = clock::time_point::max();
+    unsigned long long seq = 0; // arrival order, set by PriorityLanes
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+    clock::time_point enqueued = clock::now();
+#endif
+};
+
+/**
+ * Queue policy for Distributor: one EDF heap per lane, served in lane order.
+ * A non-empty lane passed over StarvationLimit times is served next anyway.
+ */
+template <typename Item, unsigned int Lanes = 3, unsigned int StarvationLimit = 8>
+class PriorityLanes
+{
+    static_assert(Lanes > 0, "PriorityLanes needs at least one lane");
+    struct Later {
+        bool operator()(const Item& a, const Item& b) const {
+            return a.deadline != b.deadline ? a.deadline > b.deadline : a.seq > b.seq;
+        }
+    };
+    std::array<std::vector<Item>, Lanes> heaps;
+    std::array<unsigned int, Lanes> skipped {};
+    size_t count = 0;
+    unsigned long long next_seq = 0;
+
+public:
+    using value_type = Item;
+    using size_type = size_t;
+
+    bool empty() const { return count == 0; }
+    size_type size() const { return count; }
+    // each lane holds up to capacity items, whatever the other lanes hold
+    bool full(const Item& item, size_type capacity) const { return heaps[lane_of(item)].size() >= capacity; }
+
+    template <typename... Args>
+    void emplace(Args&&... args)
+    {
+        Item item(std::forward<Args>(args)...);
+        item.seq = next_seq++;
+        auto& heap = heaps[lane_of(item)];
+        heap.push_back(std::move(item));
+        std::push_heap(heap.begin(), heap.end(), Later());
+        count++;
+    }
+
+    Item& front() { return heaps[select()].front(); }
+
+    void pop()
+    {
+        unsigned int lane = select();
+        for (unsigned int l = lane+1; l < Lanes; l++)
+            if (not heaps[l].empty()) skipped[l]++;
+        skipped[lane] = 0;
+        auto& heap = heaps[lane];
+        std::pop_heap(heap.begin(), heap.end(), Later());
+        heap.pop_back();
+        count--;
+    }
+
+private:
+    static unsigned int lane_of(const Item& item) { return std::min(item.lane, Lanes-1); }
+
+    unsigned int select() const
+    {
+        for (unsigned int l = 0; l < Lanes; l++)
+            if (not heaps[l].empty() && skipped[l] >= StarvationLimit) return l;
+        for (unsigned int l = 0; l < Lanes; l++)
+            if (not heaps[l].empty()) return l;
+        throw std::logic_error("front() of empty PriorityLanes");
+    }
+};
+
+/**
+ * Thread Pool with priority lanes and optional deadlines.
+ * Items dequeued after their deadline are given to expired instead of function.
+ * capacity bounds each lane on its own, so a full bulk lane never blocks an urgent push,
+ * and a queued urgent item overtakes every bulk one.
+ */
+template <typename Type, unsigned int Lanes = 3, unsigned int StarvationLimit = 8>
+class PriorityDistributor: Distributor<Prioritized<std::remove_reference_t<Type>>,
+                                       PriorityLanes<Prioritized<std::remove_reference_t<Type>>, Lanes, StarvationLimit>> {
+    using Item = Prioritized<std::remove_reference_t<Type>>;
+    using Base = Distributor<Item, PriorityLanes<Item, Lanes, StarvationLimit>>;
+
+public:
+    using clock = typename Item::clock;
+
+    template<typename Function, typename Expired = detail::DropExpired>
+    PriorityDistributor( Function function,
+                         Expired expired = Expired(),
+                         unsigned int concurrency = std::thread::hardware_concurrency(),
+                         size_t capacity_ = std::thread::hardware_concurrency())
+        :Base([function, expired](Item item) mutable {
+                  if (clock::now() > item.deadline)
+                      expired(std::move(item.value));
+                  else
+                      function(std::move(item.value));
+              }, concurrency, capacity_) {}
+
+    template <typename T>
+    void operator()(T &&value, unsigned int lane = 0, typename clock::time_point deadline = clock::time_point::max())
+    {
+        Base::operator()(Item{std::forward<T>(value), lane, deadline});
+    }
+
+    template <typename T, typename Rep, typename Period>
+    void operator()(T &&value, unsigned int lane, std::chrono::duration<Rep, Period> within)
+    {
+        (*this)(std::forward<T>(value), lane, clock::now() + within);
+    }
+
+    using Base::pending;
+    using Base::concurrency;
+    using Base::resize;
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+    using Base::snapshot;
+#endif
+};
+
+/**
+ * One pinned Distributor per NUMA node.
+ * Producers push to the queue of the node they are running on, or name a node explicitly.
+ */
+template <typename Type, typename Queue = std::queue<std::remove_reference_t<Type>>>
+class NumaDistributor {
+    std::vector<std::unique_ptr<Distributor<Type, Queue>>> nodes;
+    std::vector<unsigned int> node_of_cpu;
+
+public:
+    template<typename Function>
+    NumaDistributor( Function function,
+                     typename Queue::size_type capacity_per_node = std::thread::hardware_concurrency())
+    {
+        for (auto& cpus : numa_nodes()) {
+            if (cpus.empty()) continue;
+            for (int cpu : cpus) {
+                if (node_of_cpu.size() <= static_cast<size_t>(cpu))
+                    node_of_cpu.resize(cpu+1, 0);
+                node_of_cpu[cpu] = nodes.size();
+            }
+            nodes.emplace_back(std::make_unique<Distributor<Type, Queue>>(function, Placement::cores(cpus), capacity_per_node));
+        }
+    }
+
+    /**
+     * push to the node the calling thread runs on.
+     */
+    template <typename T>
+    void operator()(T &&value) { push(local_node(), std::forward<T>(value)); }
+
+    template <typename T>
+    void push(unsigned int node, T &&value) { (*nodes.at(node))(std::forward<T>(value)); }
+
+    unsigned int local_node() const
+    {
+        int cpu = current_cpu();
+        return cpu >= 0 && static_cast<size_t>(cpu) < node_of_cpu.size() ? node_of_cpu[cpu] : 0;
+    }
+
+    // number of nodes with usable cpus, node indices are [0, size())
+    unsigned int size() const { return nodes.size(); }
+};
+
+#ifdef SCINART_CPPLIB_DISTRIBUTOR_METRICS
+}
+#endif
+
 }
 
 #endif
\ No newline at end of file
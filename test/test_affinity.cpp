@@ -0,0 +1,42 @@
+#include <boost/test/unit_test.hpp>
+
+#include "affinity.hpp"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace oy;
+
+BOOST_AUTO_TEST_SUITE(affinity_test)
+
+BOOST_AUTO_TEST_CASE(cpu_list)
+{
+    BOOST_CHECK((parse_cpu_list("0-3,8,10-11\n") == std::vector<int>{0,1,2,3,8,10,11}));
+    BOOST_CHECK((parse_cpu_list("5") == std::vector<int>{5}));
+    BOOST_CHECK(parse_cpu_list("").empty());
+}
+
+BOOST_AUTO_TEST_CASE(topology)
+{
+    auto allowed = allowed_cpus();
+    BOOST_REQUIRE(!allowed.empty());
+
+    // every allowed cpu lives on exactly one node.
+    std::vector<int> all;
+    for (auto& node : numa_nodes())
+        all.insert(all.end(), node.begin(), node.end());
+    std::sort(all.begin(), all.end());
+    BOOST_CHECK(all == allowed);
+}
+
+BOOST_AUTO_TEST_CASE(pin)
+{
+    int cpu = allowed_cpus().back();
+    std::thread([cpu]() {
+        BOOST_REQUIRE(pin_this_thread(cpu));
+        BOOST_CHECK(current_cpu() == cpu);
+    }).join();
+    BOOST_CHECK(!pin_this_thread(-1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
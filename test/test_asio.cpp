@@ -5,6 +5,13 @@
 #include <chrono>
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+#include <map>
+#include <set>
 
 #include <boost/test/unit_test.hpp>
 #include <boost/timer/timer.hpp>
@@ -135,4 +142,519 @@ BOOST_AUTO_TEST_CASE(asio_socket)
     io_service_work.reset(nullptr);
 }
 
+// nobody runs io_service here
+BOOST_AUTO_TEST_CASE(asio_socket_inline)
+{
+    boost::asio::io_service io_service;
+    SyncBoostIO io(io_service);
+    io.set_io_mode(IOMode::inline_poll);
+    unsigned short port = 0;
+    io.listen(port);
+
+    auto client_future = std::async(std::launch::async, [&io, port]() {
+        Socket client = io.connect("localhost", port);
+        BOOST_CHECK(client.get_io_mode() == IOMode::inline_poll);
+        for (int i = 0; i < packet_num; i++) {
+            client.write(i);
+            BOOST_CHECK_EQUAL(client.read<int>(), i * 2);
+        }
+        std::this_thread::sleep_for(300ms);
+    });
+
+    Socket server = io.accept();
+    server.set_read_timeout(100ms);
+    for (int i = 0; i < packet_num; i++) {
+        int value = server.read<int>();
+        BOOST_CHECK_EQUAL(value, i);
+        server.write(value * 2);
+    }
+    boost::timer::cpu_timer timer;
+    try {
+        server.read<int>();
+        BOOST_CHECK_MESSAGE(false, "read should have timed out");
+    } catch(boost::system::system_error& e) {
+        BOOST_CHECK(e.code() == boost::system::errc::resource_unavailable_try_again);
+    }
+    BOOST_CHECK(std::chrono::nanoseconds(timer.elapsed().wall) >= 90ms);
+    client_future.get();
+    try {
+        server.read<int>();
+        BOOST_CHECK_MESSAGE(false, "read should have failed");
+    } catch(boost::system::system_error& e) {
+        BOOST_CHECK(e.code() == boost::asio::error::eof);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(asio_socket_read_buffer)
+{
+    for (IOMode mode : {IOMode::handoff, IOMode::inline_poll}) {
+        boost::asio::io_service io_service;
+        auto work = std::make_unique<boost::asio::io_service::work>(io_service);
+        std::thread io_thread([&io_service]() { io_service.run(); });
+        SyncBoostIO io(io_service);
+        io.set_io_mode(mode);
+        unsigned short port = 0;
+        io.listen(port);
+
+        auto client_future = std::async(std::launch::async, [&io, port]() {
+            Socket client = io.connect("localhost", port);
+            std::vector<uint16_t> fields;
+            for (uint16_t i = 0; i < 100; i++) fields.push_back(i);
+            client.write(fields);
+            std::vector<char> big(1000, 'x');
+            client.write(big);
+            std::this_thread::sleep_for(300ms);
+        });
+
+        Socket server = io.accept();
+        server.set_read_timeout(200ms);
+        server.set_read_buffer(64);
+        BOOST_CHECK_THROW(server.peek(65), std::invalid_argument);
+        auto header = server.peek(4);
+        uint16_t first;
+        std::memcpy(&first, header.data(), sizeof(first));
+        BOOST_CHECK_EQUAL(first, 0);
+        BOOST_CHECK(server.buffered() >= 4);
+        server.consume(2);
+        for (uint16_t i = 1; i < 100; i++)
+            BOOST_CHECK_EQUAL(server.read<uint16_t>(), i);
+        auto big = server.read<char>(1000); // larger than the buffer
+        BOOST_CHECK(big == std::vector<char>(1000, 'x'));
+        BOOST_CHECK_EQUAL(server.buffered(), 0u);
+        BOOST_CHECK_THROW(server.read<int>(), boost::system::system_error);
+        server.set_read_buffer(0);
+
+        client_future.get();
+        work.reset();
+        io_thread.join();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(asio_socket_gather_write)
+{
+    for (IOMode mode : {IOMode::handoff, IOMode::inline_poll}) {
+        boost::asio::io_service io_service;
+        auto work = std::make_unique<boost::asio::io_service::work>(io_service);
+        std::thread io_thread([&io_service]() { io_service.run(); });
+        SyncBoostIO io(io_service);
+        io.set_io_mode(mode);
+        unsigned short port = 0;
+        io.listen(port);
+
+        auto client_future = std::async(std::launch::async, [&io, port]() {
+            Socket client = io.connect("localhost", port);
+            int header = 3;
+            std::vector<int> payload {7, 8, 9};
+            client.write_all(header, payload, std::string("end"));
+
+            client.cork();
+            for (int i = 0; i < 10; i++)
+                client.write(i);
+            BOOST_CHECK_EQUAL(client.unflushed(), 10 * sizeof(int));
+            client.uncork();
+            BOOST_CHECK_EQUAL(client.unflushed(), 0u);
+
+            // the server stops reading: a big write stalls, and times out
+            client.set_write_timeout(200ms);
+            std::vector<char> big(64 << 20);
+            boost::timer::cpu_timer timer;
+            try {
+                client.write(big);
+                BOOST_CHECK_MESSAGE(false, "write should have timed out");
+            } catch(boost::system::system_error& e) {
+                BOOST_CHECK(e.code() == boost::system::errc::resource_unavailable_try_again);
+            }
+            BOOST_CHECK(std::chrono::nanoseconds(timer.elapsed().wall) >= 190ms);
+        });
+
+        Socket server = io.accept();
+        size_t n = server.read<int>();
+        BOOST_CHECK_EQUAL(n, 3u);
+        BOOST_CHECK((server.read<int>(n) == std::vector<int>{7, 8, 9}));
+        BOOST_CHECK((server.read<char>(3) == std::vector<char>{'e', 'n', 'd'}));
+        for (int i = 0; i < 10; i++)
+            BOOST_CHECK_EQUAL(server.read<int>(), i);
+        client_future.get();
+        work.reset();
+        io_thread.join();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(asio_socket_send_file)
+{
+    std::string src = "/tmp/oy-send-file-" + std::to_string(::getpid());
+    std::string dst = src + ".out";
+    std::vector<char> content(3 << 20);
+    for (size_t i = 0; i < content.size(); i++) content[i] = char(i * 7 + i / 4096);
+    {
+        std::ofstream out(src, std::ios::binary);
+        out.write(content.data(), content.size());
+    }
+    const uint64_t offset = 1000, len = (2 << 20) + 7;
+    auto expected = std::vector<char>(content.begin() + offset, content.begin() + offset + len);
+
+    for (IOMode mode : {IOMode::handoff, IOMode::inline_poll}) {
+        boost::asio::io_service io_service;
+        auto work = std::make_unique<boost::asio::io_service::work>(io_service);
+        std::thread io_thread([&io_service]() { io_service.run(); });
+        SyncBoostIO io(io_service);
+        io.set_io_mode(mode);
+        unsigned short port = 0;
+        io.listen(port);
+
+        auto client_future = std::async(std::launch::async, [&]() {
+            Socket client = io.connect("localhost", port);
+            std::vector<uint64_t> progress;
+            client.cork();
+            client.write(len);
+            client.send_file(src, offset, len, [&](uint64_t sent) { progress.push_back(sent); });
+            BOOST_CHECK(progress.size() >= 3u);
+            BOOST_CHECK(std::is_sorted(progress.begin(), progress.end()));
+            BOOST_CHECK_EQUAL(progress.back(), len);
+            client.uncork();
+            // the file back, as plain writes
+            client.write(expected);
+            BOOST_CHECK(client.read<char>() == 'k');
+        });
+
+        Socket server = io.accept();
+        server.set_read_timeout(2s);
+        BOOST_CHECK_EQUAL(server.read<uint64_t>(), len);
+        BOOST_CHECK(server.read<char>(len) == expected);
+
+        // some bytes already sit in the read buffer
+        server.set_read_buffer(4096);
+        BOOST_CHECK_EQUAL(server.peek(10).size(), 10u);
+        uint64_t received = 0;
+        server.receive_to_file(dst, 0, len, [&](uint64_t n) { received = n; });
+        BOOST_CHECK_EQUAL(received, len);
+        std::ifstream in(dst, std::ios::binary);
+        std::vector<char> written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        BOOST_CHECK(written == expected);
+        server.write('k');
+        client_future.get();
+
+        // nothing more comes
+        server.set_read_timeout(50ms);
+        BOOST_CHECK_THROW(server.receive_to_file(dst, 0, 1), boost::system::system_error);
+        BOOST_CHECK(!server.reusable());
+        work.reset();
+        io_thread.join();
+        std::remove(dst.c_str());
+    }
+    std::remove(src.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(connection_pool)
+{
+    boost::asio::io_service io_service;
+    SyncBoostIO io(io_service);
+    ConnectionPool::Limits limits;
+    limits.max_per_host = 2;
+    limits.checkout_timeout = 100ms;
+    io.use_connection_pool(limits);
+    io.set_io_mode(IOMode::inline_poll);
+    unsigned short port = 0;
+    io.listen(port);
+
+    // echoes ints on each accepted connection, until the peer closes or sends -1
+    std::atomic<int> accepted {0};
+    std::vector<std::thread> servers;
+    std::thread acceptor([&]() {
+        for (int i = 0; i < 4; i++) {
+            auto s = std::make_shared<Socket>(io.accept());
+            accepted++;
+            servers.emplace_back([s]() {
+                s->set_read_timeout(5s);
+                try {
+                    while (true) {
+                        int v = s->read<int>();
+                        if (v == -1) return; // close it while the client keeps it idle
+                        s->write(v);
+                    }
+                } catch (boost::system::system_error&) {}
+            });
+        }
+    });
+    ConnectionPool& pool = *io.connection_pool();
+    auto round_trip = [](Socket& s, int v) { s.write(v); return s.read<int>(); };
+
+    {
+        Socket s = io.connect("localhost", port);
+        BOOST_CHECK_EQUAL(round_trip(s, 1), 1);
+    }
+    BOOST_CHECK_EQUAL(pool.idle("localhost", port), 1u);
+    {
+        Socket s = io.connect("localhost", port); // the same connection again
+        BOOST_CHECK_EQUAL(round_trip(s, 2), 2);
+        BOOST_CHECK_EQUAL(accepted.load(), 1);
+
+        // the limit of 2 per host
+        Socket t = io.connect("localhost", port);
+        BOOST_CHECK_EQUAL(pool.live("localhost", port), 2u);
+        BOOST_CHECK_THROW(io.connect("localhost", port), boost::system::system_error);
+        BOOST_CHECK_EQUAL(round_trip(t, 3), 3);
+    }
+    BOOST_CHECK_EQUAL(pool.idle("localhost", port), 2u);
+
+    // a connection the server closed while idle is not handed out
+    {
+        Socket s = io.connect("localhost", port);
+        s.write(-1);
+    }
+    std::this_thread::sleep_for(50ms);
+    {
+        Socket s = io.connect("localhost", port);
+        Socket t = io.connect("localhost", port);
+        BOOST_CHECK_EQUAL(round_trip(s, 4), 4);
+        BOOST_CHECK_EQUAL(round_trip(t, 5), 5);
+        BOOST_CHECK_EQUAL(accepted.load(), 3);
+
+        // a failed read leaves the stream unusable: not returned
+        t.set_read_timeout(20ms);
+        BOOST_CHECK_THROW(t.read<int>(), boost::system::system_error);
+        BOOST_CHECK(!t.reusable());
+    }
+    BOOST_CHECK_EQUAL(pool.live("localhost", port), 1u);
+    BOOST_CHECK_EQUAL(pool.idle("localhost", port), 1u);
+
+    {
+        Socket s = io.connect("localhost", port);
+        Socket t = io.connect("localhost", port);
+        s.write(-1);
+        t.write(-1);
+    }
+    acceptor.join();
+    for (auto& t : servers)
+        t.join();
+}
+
+namespace
+{
+// answers each int with its double, until the peer closes
+struct Doubler
+{
+    AsyncSocket sock;
+    int value = 0;
+    Doubler(boost::asio::io_service& io_service, std::unique_ptr<boost::asio::ip::tcp::socket>&& s):sock(io_service, std::move(s)){}
+    void serve(std::shared_ptr<Doubler> self)
+    {
+        sock.async_read(value, [this, self](const boost::system::error_code& ec) {
+            if (ec) return;
+            value *= 2;
+            sock.async_write(value, [this, self](const boost::system::error_code& ec_) { if (not ec_) serve(self); });
+        });
+    }
+};
+
+struct Asker
+{
+    AsyncSocket sock;
+    Latch& done;
+    int i = 0, answer = 0;
+    bool correct = true;
+    Asker(boost::asio::io_service& io_service, Latch& done_):sock(io_service), done(done_){}
+    void ask()
+    {
+        if (i == packet_num) return done.count_down();
+        sock.async_write(i, [this](const boost::system::error_code& ec) {
+            if (ec) { correct = false; return done.count_down(); }
+            sock.async_read<int>([this](const boost::system::error_code& ec_, int answer_) {
+                correct = correct && not ec_ && answer_ == i * 2;
+                i++;
+                ask();
+            });
+        });
+    }
+};
+}
+
+// many connections, served by two threads
+BOOST_AUTO_TEST_CASE(async_socket_many)
+{
+    constexpr int connections = 50;
+    boost::asio::io_service io_service;
+    auto work = std::make_unique<boost::asio::io_service::work>(io_service);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 2; i++)
+        threads.emplace_back([&io_service]() { io_service.run(); });
+
+    boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), 0));
+    int port = acceptor.local_endpoint().port();
+    std::function<void()> accept_next = [&]() {
+        auto s = std::make_shared<std::unique_ptr<boost::asio::ip::tcp::socket>>(std::make_unique<boost::asio::ip::tcp::socket>(io_service));
+        acceptor.async_accept(**s, [&, s](const boost::system::error_code& ec) {
+            if (ec) return;
+            auto d = std::make_shared<Doubler>(io_service, std::move(*s));
+            d->serve(d);
+            accept_next();
+        });
+    };
+    accept_next();
+
+    Latch done(connections);
+    std::vector<std::unique_ptr<Asker>> askers;
+    for (int c = 0; c < connections; c++) {
+        askers.push_back(std::make_unique<Asker>(io_service, done));
+        Asker* a = askers.back().get();
+        a->sock.async_connect("localhost", port, [a](const boost::system::error_code& ec) {
+            if (ec) { a->correct = false; return a->done.count_down(); }
+            a->ask();
+        });
+    }
+    done.wait();
+    for (auto& a : askers) {
+        BOOST_CHECK(a->correct);
+        BOOST_CHECK_EQUAL(a->i, packet_num);
+    }
+
+    // a read nobody answers times out
+    Latch timed_out(1);
+    boost::system::error_code read_ec;
+    int value;
+    askers[0]->sock.set_read_timeout(50ms);
+    askers[0]->sock.async_read(value, [&](const boost::system::error_code& ec) { read_ec = ec; timed_out.count_down(); });
+    timed_out.wait();
+    BOOST_CHECK(read_ec == boost::asio::error::try_again);
+
+    askers.clear();
+    boost::asio::post(io_service, [&acceptor]() { acceptor.close(); });
+    work.reset();
+    for (auto& t : threads)
+        t.join();
+}
+
+BOOST_AUTO_TEST_CASE(multi_core_server)
+{
+    std::mutex mtx;
+    std::map<boost::asio::io_service*, std::set<std::thread::id>> threads;
+    unsigned short port = 0;
+    int cpu = allowed_cpus().front();
+    MultiCoreServer server(port, [&](MultiCoreServer::sock_ptr sock, boost::asio::io_service& io) {
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            threads[&io].insert(std::this_thread::get_id());
+        }
+        auto d = std::make_shared<Doubler>(io, std::move(sock));
+        d->serve(d);
+    }, Placement::cores({cpu, cpu}));
+    BOOST_CHECK_EQUAL(server.size(), 2u);
+
+    boost::asio::io_service io_service;
+    constexpr int connections = 20;
+    for (int c = 0; c < connections; c++) {
+        Socket client(io_service);
+        client.set_io_mode(IOMode::inline_poll);
+        client.connect("localhost", port);
+        client.write(c);
+        BOOST_CHECK_EQUAL(client.read<int>(), c * 2);
+    }
+    BOOST_CHECK_EQUAL(server.accepted(0) + server.accepted(1), size_t(connections));
+    // each core's connections were handled by that core's thread only
+    for (auto& [io, ids] : threads) {
+        BOOST_CHECK(io == &server.io_service(0) || io == &server.io_service(1));
+        BOOST_CHECK_EQUAL(ids.size(), 1u);
+    }
+
+    // stop() lets a connection being served finish, and refuses new ones
+    std::future<void> stopping;
+    {
+        Socket client(io_service);
+        client.set_io_mode(IOMode::inline_poll);
+        client.connect("localhost", port);
+        while (server.accepted(0) + server.accepted(1) != connections + 1)
+            std::this_thread::sleep_for(1ms);
+        stopping = std::async(std::launch::async, [&]() { server.stop(); });
+        std::this_thread::sleep_for(50ms);
+        client.write(21);
+        BOOST_CHECK_EQUAL(client.read<int>(), 42);
+        Socket refused(io_service);
+        refused.set_io_mode(IOMode::inline_poll);
+        BOOST_CHECK_THROW(refused.connect("localhost", port), boost::system::system_error);
+        BOOST_CHECK(stopping.wait_for(0s) == std::future_status::timeout);
+    }
+    stopping.get();
+}
+
+BOOST_AUTO_TEST_CASE(async_semaphore)
+{
+    boost::asio::io_service io_service;
+    AsyncSemaphore sem(io_service, 1);
+    std::vector<int> done;
+    boost::system::error_code timed;
+    sem.async_wait([&](const boost::system::error_code& ec) { BOOST_CHECK(!ec); done.push_back(1); });
+    sem.async_wait([&](const boost::system::error_code& ec) { BOOST_CHECK(!ec); done.push_back(2); });
+    sem.async_wait(50ms, [&](const boost::system::error_code& ec) { timed = ec; done.push_back(3); });
+    BOOST_CHECK(done.empty()); // handlers only run through the io_service
+
+    // the waits for 2 and 3 have no unit; only the one for 3 times out
+    io_service.run();
+    BOOST_CHECK((done == std::vector<int>{1, 3}));
+    BOOST_CHECK(timed == boost::asio::error::timed_out);
+
+    sem.release(2);
+    io_service.restart();
+    io_service.run();
+    BOOST_CHECK((done == std::vector<int>{1, 3, 2}));
+    BOOST_CHECK(sem.try_wait());
+    BOOST_CHECK(!sem.try_wait());
+
+    // granted before the timeout, and nodes are reused
+    for (int i = 0; i < 3; i++) {
+        bool ok = false;
+        sem.async_wait(10s, [&](const boost::system::error_code& ec) { ok = !ec; });
+        sem.release();
+        io_service.restart();
+        io_service.run();
+        BOOST_CHECK(ok);
+    }
+
+    boost::system::error_code aborted;
+    sem.async_wait([&](const boost::system::error_code& ec) { aborted = ec; });
+    sem.cancel();
+    io_service.restart();
+    io_service.run();
+    BOOST_CHECK(aborted == boost::asio::error::operation_aborted);
+}
+
+BOOST_AUTO_TEST_CASE(async_semaphore_deadline_after_release)
+{
+    boost::asio::io_service io_service;
+    AsyncSemaphore sem(io_service);
+    // armed first, so it completes first once everything has expired: the release then
+    // dequeues waits whose timers already completed with success
+    boost::asio::steady_timer releaser(io_service, 1ms);
+    releaser.async_wait([&](const boost::system::error_code&) { sem.release(2); });
+    std::vector<boost::system::error_code> got;
+    for (int i = 0; i < 2; i++)
+        sem.async_wait(1ms, [&](const boost::system::error_code& ec) { got.push_back(ec); });
+    std::this_thread::sleep_for(20ms);
+    io_service.run();
+    BOOST_REQUIRE_EQUAL(got.size(), 2u); // each handler exactly once
+    BOOST_CHECK(!got[0] && !got[1]);
+    BOOST_CHECK(!sem.try_wait()); // both units went to the waits
+
+    // the queue is still sound, and the timeouts still work
+    boost::system::error_code timed;
+    sem.async_wait(1ms, [&](const boost::system::error_code& ec) { timed = ec; });
+    io_service.restart();
+    io_service.run();
+    BOOST_CHECK(timed == boost::asio::error::timed_out);
+}
+
+BOOST_AUTO_TEST_CASE(async_semaphore_destroyed_while_waiting)
+{
+    boost::asio::io_service io_service;
+    int called = 0;
+    {
+        AsyncSemaphore sem(io_service);
+        sem.async_wait(10s, [&](const boost::system::error_code&) { called++; });
+        sem.async_wait(1ms, [&](const boost::system::error_code&) { called++; });
+        sem.async_wait([&](const boost::system::error_code&) { called++; });
+    }
+    // the timers of the dropped waits complete now, after the semaphore is gone
+    io_service.run();
+    BOOST_CHECK_EQUAL(called, 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,173 @@
+#include <boost/test/unit_test.hpp>
+
+#include "codec.hpp"
+#include <array>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace oy;
+
+namespace
+{
+
+// an in-memory TypedStream, counting the writes it gets
+class MemoryStream : public detail::TypedStream<MemoryStream>
+{
+    friend class detail::TypedStream<MemoryStream>;
+public:
+    std::string bytes;
+    size_t pos = 0;
+    size_t writes = 0, buffers = 0;
+
+private:
+    void read_buffer(boost::asio::mutable_buffer b)
+    {
+        if (pos + b.size() > bytes.size())
+            throw boost::system::system_error(boost::asio::error::eof);
+        bytes.copy(static_cast<char*>(b.data()), b.size(), pos);
+        pos += b.size();
+    }
+    void write_buffers(const boost::asio::const_buffer* bufs, size_t count)
+    {
+        writes++;
+        buffers += count;
+        for (size_t i = 0; i < count; i++)
+            bytes.append(static_cast<const char*>(bufs[i].data()), bufs[i].size());
+    }
+};
+
+struct Header
+{
+    uint32_t id;
+    uint16_t flags;
+    double weight;
+};
+
+struct Named
+{
+    int id;
+    std::string name;
+};
+
+}
+
+namespace oy
+{
+template <>
+struct Codec<Named>
+{
+    template <typename E> static void encode(E& e, const Named& n) { e.put(n.id); e.put(n.name); }
+    template <typename D> static void decode(D& d, Named& n) { d.get(n.id); d.get(n.name); }
+};
+}
+
+BOOST_AUTO_TEST_SUITE(codec_test)
+
+BOOST_AUTO_TEST_CASE(codec_round_trip)
+{
+    static_assert(detail::is_bitwise<Header>);
+    static_assert(!detail::is_bitwise<int*>);
+    static_assert(!detail::is_bitwise<std::string>);
+
+    MemoryStream s;
+    Header h {7, 3, 0.5};
+    std::string text = "hello";
+    std::vector<std::vector<int>> nested {{1, 2}, {}, {3}};
+    std::map<std::string, std::vector<double>> by_name {{"a", {1.5}}, {"b", {2.5, 3.5}}};
+    std::unordered_map<int, std::string> by_id {{1, "one"}, {2, "two"}};
+    std::array<uint16_t, 3> triple {4, 5, 6};
+    std::pair<int, std::string> pair {9, "nine"};
+    std::vector<bool> bits {true, false, true};
+    std::vector<Named> named {{1, "x"}, {2, "yy"}};
+    encode(s, h, text, nested, by_name, by_id, triple, pair, bits, named);
+    BOOST_CHECK_EQUAL(s.writes, 1u);
+
+    Header h2;
+    std::string text2;
+    std::vector<std::vector<int>> nested2;
+    std::map<std::string, std::vector<double>> by_name2;
+    std::unordered_map<int, std::string> by_id2;
+    std::array<uint16_t, 3> triple2;
+    std::pair<int, std::string> pair2;
+    std::vector<bool> bits2;
+    std::vector<Named> named2;
+    decode(s, h2, text2, nested2, by_name2, by_id2, triple2, pair2, bits2, named2);
+    BOOST_CHECK_EQUAL(h2.id, 7u);
+    BOOST_CHECK_EQUAL(h2.flags, 3);
+    BOOST_CHECK_EQUAL(h2.weight, 0.5);
+    BOOST_CHECK_EQUAL(text2, text);
+    BOOST_CHECK(nested2 == nested);
+    BOOST_CHECK(by_name2 == by_name);
+    BOOST_CHECK(by_id2 == by_id);
+    BOOST_CHECK(triple2 == triple);
+    BOOST_CHECK(pair2 == pair);
+    BOOST_CHECK(bits2 == bits);
+    BOOST_REQUIRE_EQUAL(named2.size(), 2u);
+    BOOST_CHECK_EQUAL(named2[1].name, "yy");
+    BOOST_CHECK_EQUAL(s.pos, s.bytes.size());
+}
+
+BOOST_AUTO_TEST_CASE(codec_bulk)
+{
+    // a large array goes out as one buffer of its own, between the copied small values
+    MemoryStream s;
+    std::vector<uint32_t> big(100000);
+    for (size_t i = 0; i < big.size(); i++) big[i] = uint32_t(i);
+    encode(s, uint8_t(1), big, uint8_t(2));
+    BOOST_CHECK_EQUAL(s.writes, 1u);
+    BOOST_CHECK_EQUAL(s.buffers, 3u);
+    BOOST_CHECK_EQUAL(decode<uint8_t>(s), 1);
+    BOOST_CHECK(decode<std::vector<uint32_t>>(s) == big);
+    BOOST_CHECK_EQUAL(decode<uint8_t>(s), 2);
+
+    // a length beyond the limit fails before allocating
+    MemoryStream bad;
+    bad.write(uint64_t(1) << 40);
+    try {
+        decode<std::vector<char>>(bad);
+        BOOST_ERROR("decode should fail");
+    } catch (boost::system::system_error& e) {
+        BOOST_CHECK(e.code() == boost::asio::error::message_size);
+    }
+
+    // the limit is in bytes, whatever the element size
+    MemoryStream wide;
+    encode(wide, std::vector<char>(200), std::vector<uint64_t>(200));
+    Decoder<MemoryStream> d(wide, 1000);
+    std::vector<char> narrow;
+    d.get(narrow);
+    BOOST_CHECK_EQUAL(narrow.size(), 200u);
+    std::vector<uint64_t> too_big;
+    BOOST_CHECK_THROW(d.get(too_big), boost::system::system_error);
+
+    // nested lengths draw on the same budget: each inner one fits, all of them do not
+    MemoryStream nested;
+    encode(nested, std::vector<std::string>(10, std::string(100, 'x')));
+    BOOST_CHECK_EQUAL(decode<std::vector<std::string>>(nested).size(), 10u);
+    encode(nested, std::vector<std::string>(10, std::string(100, 'x')));
+    Decoder<MemoryStream> small(nested, 10 * sizeof(std::string) + 500);
+    std::vector<std::string> strings;
+    BOOST_CHECK_THROW(small.get(strings), boost::system::system_error);
+}
+
+BOOST_AUTO_TEST_CASE(codec_byte_order)
+{
+    MemoryStream s;
+    encode<ByteOrder::big>(s, uint32_t(0x01020304), std::vector<uint16_t>{0x0a0b, 0x0c0d});
+    BOOST_CHECK_EQUAL(s.bytes.substr(0, 4), std::string("\x01\x02\x03\x04", 4));
+    // the length prefix is big endian too
+    BOOST_CHECK_EQUAL(s.bytes.substr(4, 8), std::string("\0\0\0\0\0\0\0\x02", 8));
+    BOOST_CHECK_EQUAL(s.bytes.substr(12), std::string("\x0a\x0b\x0c\x0d", 4));
+    BOOST_CHECK_EQUAL((decode<uint32_t, ByteOrder::big>(s)), 0x01020304u);
+    BOOST_CHECK((decode<std::vector<uint16_t>, ByteOrder::big>(s) == std::vector<uint16_t>{0x0a0b, 0x0c0d}));
+
+    std::vector<double> values(1000);
+    for (size_t i = 0; i < values.size(); i++) values[i] = i * 0.25;
+    MemoryStream le;
+    encode<ByteOrder::little>(le, values);
+    BOOST_CHECK((decode<std::vector<double>, ByteOrder::little>(le) == values));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
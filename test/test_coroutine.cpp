@@ -0,0 +1,172 @@
+#include <boost/test/unit_test.hpp>
+
+#include "coroutine.hpp"
+
+// build the tests with EXTRA_CXXFLAGS=-std=c++20 to run these.
+#if __cpp_impl_coroutine >= 201902L
+
+#include "asio.hpp"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+Task<int> answer() { co_return 42; }
+
+Task<long long> sum(int n)
+{
+    long long s = 0;
+    for (int i = 0; i < n; i++)
+        s += co_await answer(); // each completes synchronously: needs symmetric transfer
+    co_return s;
+}
+
+Task<void> fail() { throw std::runtime_error("fail"); co_return; }
+
+Task<int> await_in(Task<int>& task) { co_return co_await std::move(task); }
+
+Task<std::thread::id> hop(TaskPool& pool)
+{
+    co_await pool.schedule();
+    co_return std::this_thread::get_id();
+}
+
+Task<void> consumer(Semaphore& sem, TaskPool& pool, std::atomic<int>& consumed)
+{
+    co_await async_wait(sem, pool);
+    consumed++;
+}
+
+Task<void> echo_client(Socket& sock, std::vector<int>& got)
+{
+    std::vector<int> v {1, 2, 3};
+    co_await sock.co_write(v);
+    int x = 0;
+    co_await sock.co_read(x);
+    got.push_back(x);
+    try {
+        co_await sock.co_read(x);
+    } catch (boost::system::system_error& e) {
+        got.push_back(e.code() == boost::system::errc::resource_unavailable_try_again ? -1 : -2);
+    }
+}
+
+Task<void> async_echo_client(AsyncSocket& sock, std::vector<int>& got)
+{
+    std::vector<int> v {4, 5, 6};
+    co_await sock.co_write(v);
+    int x = 0;
+    co_await sock.co_read(x);
+    got.push_back(x);
+    try {
+        co_await sock.co_read(x);
+    } catch (boost::system::system_error& e) {
+        got.push_back(e.code() == boost::system::errc::resource_unavailable_try_again ? -1 : -2);
+    }
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(coroutine_test)
+
+BOOST_AUTO_TEST_CASE(task_chain)
+{
+    BOOST_CHECK(sync_wait(answer()) == 42);
+    BOOST_CHECK(sync_wait(sum(10000)) == 420000LL);
+    BOOST_CHECK_THROW(sync_wait(fail()), std::runtime_error);
+
+    Task<int> task = answer();
+    Task<int> moved = std::move(task);
+    BOOST_CHECK_THROW(sync_wait(std::move(task)), std::logic_error);
+    BOOST_CHECK_THROW(sync_wait(await_in(task)), std::logic_error);
+    BOOST_CHECK(sync_wait(std::move(moved)) == 42);
+}
+
+BOOST_AUTO_TEST_CASE(schedule_on_pool)
+{
+    TaskPool pool(2);
+    BOOST_CHECK(sync_wait(hop(pool)) != std::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(semaphore_holds_no_thread)
+{
+    // far more waiting coroutines than workers
+    TaskPool pool(2, 8);
+    Semaphore sem;
+    std::atomic<int> consumed {0};
+    for (int i = 0; i < 1000; i++)
+        spawn(pool, consumer(sem, pool, consumed));
+    std::this_thread::sleep_for(50ms);
+    BOOST_CHECK(consumed == 0);
+    for (int i = 0; i < 1000; i++)
+        sem.notify();
+    for (int i = 0; i < 100 && consumed != 1000; i++)
+        std::this_thread::sleep_for(10ms);
+    BOOST_CHECK(consumed == 1000);
+}
+
+BOOST_AUTO_TEST_CASE(socket_awaitables)
+{
+    boost::asio::io_service io_service;
+    auto work = std::make_unique<boost::asio::io_service::work>(io_service);
+    std::thread io_thread([&io_service]() { io_service.run(); });
+
+    SyncBoostIO io(io_service);
+    unsigned short port = 0;
+    io.listen(port);
+    std::thread server([&io]() {
+        Socket s = io.accept();
+        auto v = s.read<int>(3);
+        s.write(v[0] + v[1] + v[2]);
+        std::this_thread::sleep_for(300ms);
+    });
+    Socket client = io.connect("127.0.0.1", port);
+    client.set_read_timeout(100ms);
+    std::vector<int> got;
+    sync_wait(echo_client(client, got));
+    BOOST_CHECK((got == std::vector<int>{6, -1}));
+
+    server.join();
+    work.reset();
+    io_thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(async_socket_awaitables)
+{
+    boost::asio::io_service io_service;
+    auto work = std::make_unique<boost::asio::io_service::work>(io_service);
+    std::thread io_thread([&io_service]() { io_service.run(); });
+
+    SyncBoostIO io(io_service);
+    unsigned short port = 0;
+    io.listen(port);
+    std::thread server([&io]() {
+        Socket s = io.accept();
+        auto v = s.read<int>(3);
+        s.write(v[0] + v[1] + v[2]);
+        std::this_thread::sleep_for(300ms);
+    });
+    AsyncSocket client(io_service);
+    Semaphore connected;
+    client.async_connect("127.0.0.1", port, [&connected](const boost::system::error_code& ec) { BOOST_CHECK(!ec); connected.notify(); });
+    connected.wait();
+    client.set_read_timeout(100ms);
+    std::vector<int> got;
+    sync_wait(async_echo_client(client, got));
+    BOOST_CHECK((got == std::vector<int>{15, -1}));
+
+    server.join();
+    work.reset();
+    io_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
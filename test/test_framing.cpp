@@ -0,0 +1,161 @@
+#include <boost/test/unit_test.hpp>
+
+#include "framing.hpp"
+#include "asio.hpp"
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+// an in-memory stream with Socket's read and write_all
+struct MemoryStream
+{
+    std::string bytes;
+    size_t pos = 0;
+
+    void read(char* p, size_t n)
+    {
+        if (pos + n > bytes.size())
+            throw boost::system::system_error(boost::asio::error::eof);
+        bytes.copy(p, n, pos);
+        pos += n;
+    }
+    template <typename... Ts>
+    void write_all(const Ts&... ts) { (bytes.append(ts.data(), ts.size()), ...); }
+};
+
+}
+
+BOOST_AUTO_TEST_SUITE(framing_test)
+
+BOOST_AUTO_TEST_CASE(frames_round_trip)
+{
+    for (auto prefix : {LengthPrefix::varint, LengthPrefix::fixed32}) {
+        FrameFormat format;
+        format.prefix = prefix;
+        MemoryStream s;
+        std::vector<std::string> messages {"", "a", std::string(127, 'b'), std::string(128, 'c'), std::string(100000, 'd')};
+        for (auto& m : messages)
+            write_frame(s, m, format);
+        SlabPool pool(4096);
+        for (auto& m : messages)
+            BOOST_CHECK(read_frame(s, pool, format).view() == m);
+        BOOST_CHECK_THROW(read_frame(s, pool, format), boost::system::system_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(varint_prefix)
+{
+    MemoryStream s;
+    write_frame(s, std::string(300, 'x'));
+    // 300 = 0b10'0101100
+    BOOST_CHECK_EQUAL((unsigned char)s.bytes[0], 0xac);
+    BOOST_CHECK_EQUAL((unsigned char)s.bytes[1], 0x02);
+    BOOST_CHECK_EQUAL(s.bytes.size(), 302u);
+}
+
+BOOST_AUTO_TEST_CASE(max_size_guard)
+{
+    FrameFormat small;
+    small.max_size = 10;
+    MemoryStream s;
+    BOOST_CHECK_THROW(write_frame(s, std::string(11, 'x'), small), boost::system::system_error);
+    write_frame(s, std::string(11, 'x'));
+    SlabPool pool;
+    try {
+        read_frame(s, pool, small);
+        BOOST_CHECK_MESSAGE(false, "oversized frame should be refused");
+    } catch (boost::system::system_error& e) {
+        BOOST_CHECK(e.code() == boost::asio::error::message_size);
+    }
+    // an endless varint is refused too
+    MemoryStream bad;
+    bad.bytes.assign(20, char(0xff));
+    BOOST_CHECK_THROW(read_frame(bad, pool), boost::system::system_error);
+}
+
+BOOST_AUTO_TEST_CASE(slabs_are_recycled)
+{
+    SlabPool pool(1024, 4);
+    {
+        std::vector<BufferView> views;
+        for (int i = 0; i < 20; i++)
+            views.push_back(pool.allocate(100)); // 9 per slab with alignment
+        BufferView part = views[0].sub(10, 20);
+        views.clear();
+        BOOST_CHECK_EQUAL(part.size(), 20u);
+        BOOST_CHECK_EQUAL(pool.free_slabs(), 1u); // the first slab lives on in part
+    }
+    BOOST_CHECK_EQUAL(pool.free_slabs(), 2u);
+    // reused: no new slab while the free ones last
+    BufferView a = pool.allocate(1000);
+    BufferView b = pool.allocate(1000);
+    BOOST_CHECK_EQUAL(pool.free_slabs(), 1u);
+    // larger than a slab: not pooled
+    BufferView big = pool.allocate(5000);
+    big = BufferView();
+    BOOST_CHECK_EQUAL(pool.free_slabs(), 1u);
+
+    // views may outlive their pool
+    BufferView survivor;
+    {
+        SlabPool other(256);
+        survivor = other.allocate(10);
+        std::memset(survivor.data(), 'z', 10);
+    }
+    BOOST_CHECK(survivor.view() == std::string(10, 'z'));
+}
+
+BOOST_AUTO_TEST_CASE(frames_over_socket)
+{
+    boost::asio::io_service io_service;
+    SyncBoostIO io(io_service);
+    io.set_io_mode(IOMode::inline_poll);
+    unsigned short port = 0;
+    io.listen(port);
+    auto client = std::async(std::launch::async, [&io, port]() {
+        Socket s = io.connect("localhost", port);
+        for (int i = 0; i < 100; i++)
+            write_frame(s, std::string(i, char('a' + i % 26)));
+    });
+    Socket server = io.accept();
+    server.set_read_buffer(4096);
+    SlabPool pool;
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(read_frame(server, pool).view() == std::string(i, char('a' + i % 26)));
+    client.get();
+}
+
+BOOST_AUTO_TEST_CASE(refused_frame_breaks_socket)
+{
+    boost::asio::io_service io_service;
+    SyncBoostIO io(io_service);
+    io.set_io_mode(IOMode::inline_poll);
+    unsigned short port = 0;
+    io.listen(port);
+    FrameFormat small;
+    small.prefix = LengthPrefix::fixed32;
+    small.max_size = 10;
+    auto client = std::async(std::launch::async, [&io, port]() {
+        Socket s = io.connect("localhost", port);
+        FrameFormat fixed;
+        fixed.prefix = LengthPrefix::fixed32;
+        write_frame(s, std::string(11, 'x'), fixed);
+        s.read<char>(); // until the server is done
+    });
+    Socket server = io.accept();
+    SlabPool pool;
+    BOOST_CHECK(server.reusable());
+    BOOST_CHECK_THROW(read_frame(server, pool, small), boost::system::system_error);
+    BOOST_CHECK(!server.reusable()); // its payload is still unread
+    server.write(char(0));
+    client.get();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,44 @@
+#include <boost/test/unit_test.hpp>
+
+#include "histogram.hpp"
+#include <cstdint>
+
+using namespace oy;
+
+BOOST_AUTO_TEST_SUITE(histogram_test)
+
+BOOST_AUTO_TEST_CASE(buckets)
+{
+    for (uint64_t v : {0ull, 1ull, 7ull, 8ull, 9ull, 15ull, 16ull, 1000ull, 123456789ull, ~0ull}) {
+        auto i = LogHistogram::bucket_of(v);
+        BOOST_CHECK(i < LogHistogram::Buckets);
+        BOOST_CHECK(LogHistogram::lower_bound(i) <= v);
+        if (i + 1 < LogHistogram::Buckets)
+            BOOST_CHECK(v < LogHistogram::lower_bound(i + 1));
+    }
+    // relative error of a bucket is at most 1/8
+    auto i = LogHistogram::bucket_of(1000000);
+    BOOST_CHECK(LogHistogram::lower_bound(i + 1) - LogHistogram::lower_bound(i) <= 1000000 / 8);
+}
+
+BOOST_AUTO_TEST_CASE(percentiles)
+{
+    LogHistogram h;
+    for (uint64_t v = 1; v <= 1000; v++)
+        h.record(v);
+    BOOST_CHECK(h.count() == 1000);
+    BOOST_CHECK(h.max() == 1000);
+    BOOST_CHECK_CLOSE(h.mean(), 500.5, 0.01);
+    BOOST_CHECK_CLOSE(double(h.percentile(0.5)), 500.0, 12.5);
+    BOOST_CHECK_CLOSE(double(h.percentile(0.99)), 990.0, 12.5);
+
+    LogHistogram copy(h), merged;
+    merged.merge(h);
+    merged.merge(copy);
+    BOOST_CHECK(merged.count() == 2000);
+    BOOST_CHECK(merged.percentile(0.5) == h.percentile(0.5));
+    merged.clear();
+    BOOST_CHECK(merged.count() == 0 && merged.percentile(0.5) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
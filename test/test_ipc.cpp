@@ -0,0 +1,132 @@
+#include <boost/test/unit_test.hpp>
+
+#include "ipc.hpp"
+#include "framing.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+// the same code on every transport: answer each int with its double, until -1
+template <typename Stream>
+void serve_doubles(Stream& s)
+{
+    while (true) {
+        int v = s.template read<int>();
+        if (v == -1) return;
+        s.write(v * 2);
+    }
+}
+
+template <typename Stream>
+void ask_doubles(Stream& s)
+{
+    for (int i = 0; i < 1000; i++) {
+        s.write(i);
+        BOOST_CHECK_EQUAL(s.template read<int>(), i * 2);
+    }
+    s.write(-1);
+    std::vector<int> big(100000);
+    for (size_t i = 0; i < big.size(); i++) big[i] = int(i);
+    s.write_all(big.size(), big);
+    BOOST_CHECK(s.template read<int>(big.size()) == big);
+}
+
+// serves doubles, then echoes a size-prefixed vector of ints
+template <typename Stream>
+void serve(Stream& s)
+{
+    serve_doubles(s);
+    auto v = s.template read<int>(s.template read<size_t>());
+    s.write(v);
+}
+
+std::string unique_name(const char* what)
+{
+    return std::string(what) + "-" + std::to_string(::getpid());
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(ipc_test)
+
+BOOST_AUTO_TEST_CASE(unix_socket)
+{
+    boost::asio::io_service io_service;
+    std::string path = "/tmp/" + unique_name("oy-test") + ".sock";
+    UnixListener listener(io_service, path);
+    std::thread server([&]() {
+        UnixSocket s = listener.accept();
+        serve(s);
+    });
+    UnixSocket client(io_service);
+    client.connect(path);
+    ask_doubles(client);
+    server.join();
+
+    client.set_read_timeout(20ms);
+    BOOST_CHECK_THROW(client.read<int>(), boost::system::system_error);
+}
+
+BOOST_AUTO_TEST_CASE(shm_channel)
+{
+    std::string name = "/" + unique_name("oy-test");
+    BOOST_CHECK_THROW(ShmChannel::create(name, 1000), std::invalid_argument);
+    // a small ring, so the large message wraps around it many times
+    ShmChannel client = ShmChannel::create(name, 4096);
+    BOOST_CHECK_EQUAL(client.capacity(), 4096u);
+    std::thread server([&]() {
+        ShmChannel s = ShmChannel::open(name);
+        serve(s);
+        SlabPool pool;
+        write_frame(s, read_frame(s, pool).view());
+    });
+    ask_doubles(client);
+    write_frame(client, std::string(10000, 'x'));
+    SlabPool pool;
+    BOOST_CHECK(read_frame(client, pool).view() == std::string(10000, 'x'));
+    server.join();
+
+    // the peer is gone
+    try {
+        client.read<int>();
+        BOOST_ERROR("read should fail");
+    } catch (boost::system::system_error& e) {
+        BOOST_CHECK(e.code() == boost::asio::error::eof);
+    }
+    try {
+        client.write(1);
+        BOOST_ERROR("write should fail");
+    } catch (boost::system::system_error& e) {
+        BOOST_CHECK(e.code() == boost::asio::error::broken_pipe);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(shm_channel_timeout)
+{
+    std::string name = "/" + unique_name("oy-test-timeout");
+    ShmChannel a = ShmChannel::create(name, 64);
+    ShmChannel b = ShmChannel::open(name);
+    a.set_read_timeout(20ms);
+    try {
+        a.read<int>();
+        BOOST_ERROR("read should time out");
+    } catch (boost::system::system_error& e) {
+        BOOST_CHECK(e.code() == boost::asio::error::try_again);
+    }
+    // the ring is full after 64 bytes
+    b.set_write_timeout(20ms);
+    b.write(std::vector<char>(64));
+    BOOST_CHECK_THROW(b.write('x'), boost::system::system_error);
+    BOOST_CHECK_EQUAL(a.read<char>(64).size(), 64u);
+    b.write(42);
+    BOOST_CHECK_EQUAL(a.read<int>(), 42);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,99 @@
+#include <boost/test/unit_test.hpp>
+
+#include "parallel.hpp"
+#include "rand.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(parallel_test)
+
+BOOST_AUTO_TEST_CASE(parallel_for_visits_each_index_once)
+{
+    TaskPool pool(4);
+    std::vector<std::atomic<int>> visited(10000);
+    parallel_for(pool, 0, 10000, 7, [&](int i) { visited[i]++; });
+    BOOST_CHECK(std::all_of(visited.begin(), visited.end(), [](const auto& x) { return x == 1; }));
+
+    // adaptive grain, empty range
+    std::atomic<long long> sum {0};
+    parallel_for(pool, 0, 1000, 0, [&](int i) { sum += i; });
+    BOOST_CHECK(sum == 999*1000/2);
+    parallel_for(pool, 5, 5, 0, [&](int) { BOOST_CHECK(false); });
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_rethrows)
+{
+    TaskPool pool(4);
+    BOOST_CHECK_THROW(parallel_for(pool, 0, 1000, 1, [](int i) { if (i == 567) throw std::runtime_error("567"); }),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_join_sleeps)
+{
+    // the worker takes the long upper half; the caller, done with its half, must not spin meanwhile
+    TaskPool pool(1);
+    auto cpu_ns = []() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    };
+    std::atomic<bool> started {false};
+    auto t0 = cpu_ns();
+    parallel_for(pool, 0, 2, 1, [&](int i) {
+        if (i == 1) {
+            started = true;
+            std::this_thread::sleep_for(200ms);
+        } else {
+            while (not started) std::this_thread::sleep_for(1ms);
+        }
+    });
+    BOOST_CHECK(cpu_ns() - t0 < 50000000);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_reduce_in_order)
+{
+    TaskPool pool(4);
+    auto sum = parallel_reduce(pool, 0, 100000, 0, 0LL,
+                               [](int b, int e, long long acc) { for (; b < e; ++b) acc += b; return acc; },
+                               [](long long x, long long y) { return x + y; });
+    BOOST_CHECK(sum == 99999LL*100000/2);
+
+    // string concatenation is not commutative.
+    auto s = parallel_reduce(pool, 0, 26, 1, std::string(),
+                             [](int b, int e, std::string acc) { for (; b < e; ++b) acc += char('a'+b); return acc; },
+                             [](std::string x, std::string y) { return x + y; });
+    BOOST_CHECK(s == "abcdefghijklmnopqrstuvwxyz");
+}
+
+BOOST_AUTO_TEST_CASE(parallel_transform_and_sort)
+{
+    TaskPool pool(4);
+    oy::Rand<int> gen(-100000, 100000);
+    std::vector<int> v(100000);
+    for (auto& i : v) i = gen();
+
+    std::vector<long long> squares(v.size());
+    parallel_transform(pool, v.begin(), v.end(), squares.begin(), [](int x) { return 1LL*x*x; });
+    for (size_t i = 0; i < v.size(); i++)
+        BOOST_CHECK(squares[i] == 1LL*v[i]*v[i]);
+
+    auto expected = v;
+    std::sort(expected.begin(), expected.end());
+    parallel_sort(pool, v.begin(), v.end());
+    BOOST_CHECK(v == expected);
+
+    parallel_sort(v.begin(), v.end(), std::greater<int>(), 100);
+    BOOST_CHECK(std::equal(v.begin(), v.end(), expected.rbegin()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,117 @@
+#include <boost/test/unit_test.hpp>
+
+#include "pipeline.hpp"
+#include "rand.hpp"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+struct Line
+{
+    int number = -1;
+    std::string text;
+    int length = 0;
+};
+
+}
+
+BOOST_AUTO_TEST_SUITE(pipeline_test)
+
+BOOST_AUTO_TEST_CASE(pipeline_keeps_input_order)
+{
+    TaskPool pool(4);
+    constexpr int N = 2000;
+    int read = 0;
+    std::atomic<int> in_parallel {0}, max_in_parallel {0};
+    int serial_count = 0;
+    std::vector<int> written;
+    oy::Rand<int> delay(0, 50);
+
+    Pipeline<Line> p;
+    p.parallel([&](Line& l) {
+         int now = ++in_parallel;
+         for (int m = max_in_parallel; now > m && !max_in_parallel.compare_exchange_weak(m, now););
+         std::this_thread::sleep_for(std::chrono::microseconds(l.number % 7 * 10));
+         l.length = l.text.size();
+         in_parallel--;
+     })
+     .serial_out_of_order([&](Line&) { serial_count++; })
+     .serial_in_order([&](Line& l) {
+         BOOST_CHECK(l.length == (int)std::to_string(l.number).size());
+         written.push_back(l.number);
+     });
+    p.run([&](Line& l) {
+        if (read == N) return false;
+        l.number = read++;
+        l.text = std::to_string(l.number);
+        return true;
+    }, 8, pool);
+
+    BOOST_CHECK(serial_count == N);
+    BOOST_REQUIRE(written.size() == N);
+    for (int i = 0; i < N; i++)
+        BOOST_CHECK(written[i] == i);
+    BOOST_CHECK(max_in_parallel <= 8);
+
+    // a built pipeline can run again
+    read = 0;
+    written.clear();
+    p.run([&](Line& l) {
+        if (read == 100) return false;
+        l.number = read++;
+        l.text = std::to_string(l.number);
+        return true;
+    }, 3, pool);
+    BOOST_CHECK(written.size() == 100);
+}
+
+BOOST_AUTO_TEST_CASE(pipeline_rethrows)
+{
+    TaskPool pool(2);
+    int read = 0;
+    Pipeline<Line> p;
+    p.parallel([](Line& l) { if (l.number == 50) throw std::runtime_error("50"); });
+    // the source never ends: only the failure stops the run
+    BOOST_CHECK_THROW(p.run([&](Line& l) { l.number = read++; return true; }, 4, pool), std::runtime_error);
+    BOOST_CHECK(read > 50);
+    BOOST_CHECK_THROW(p.run([](Line&) { return false; }, 0, pool), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(pipeline_join_sleeps)
+{
+    // one token sleeps on the worker; the caller, done with the others, must not spin meanwhile
+    TaskPool pool(1);
+    auto cpu_ns = []() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    };
+    auto caller = std::this_thread::get_id();
+    std::atomic<bool> slept {false};
+    int read = 0;
+    Pipeline<Line> p;
+    p.parallel([&](Line&) {
+        if (std::this_thread::get_id() != caller && not slept.exchange(true))
+            std::this_thread::sleep_for(200ms);
+    });
+    auto t0 = cpu_ns();
+    p.run([&](Line& l) {
+        std::this_thread::sleep_for(1ms); // lets the worker pick up handed-off tokens
+        l.number = read++;
+        return read <= 20;
+    }, 4, pool);
+    BOOST_REQUIRE(slept);
+    BOOST_CHECK(cpu_ns() - t0 < 50000000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -105,5 +105,286 @@ BOOST_AUTO_TEST_CASE(semaphore_wait_timeout)
     }
 }
 
+BOOST_AUTO_TEST_CASE(semaphore_wait_for_keeps_unit)
+{
+    Semaphore sem(1);
+    BOOST_CHECK(sem.wait_for(1ms));
+    BOOST_CHECK(sem.try_wait());
+}
+
+BOOST_AUTO_TEST_CASE(semaphore_multi_permit)
+{
+    Semaphore sem(5);
+    sem.acquire(3);
+    BOOST_CHECK(!sem.try_acquire(3));
+    BOOST_CHECK(sem.try_acquire(2));
+    BOOST_CHECK(!sem.try_acquire());
+
+    // a waiter for 4 units holds none of them until all 4 are there
+    auto big = std::async(std::launch::async, [&sem]() { sem.acquire(4); });
+    this_thread::sleep_for(20ms);
+    sem.release(3);
+    BOOST_CHECK(big.wait_for(20ms) == std::future_status::timeout);
+    // and a later, smaller request does not overtake it
+    BOOST_CHECK(!sem.try_acquire(1));
+    sem.release(2);
+    big.get();
+    BOOST_CHECK(sem.try_acquire(1));
+    BOOST_CHECK(!sem.try_acquire(1));
+}
+
+BOOST_AUTO_TEST_CASE(semaphore_release_wakes_enough)
+{
+    Semaphore sem;
+    std::atomic<int> got {0};
+    std::vector<std::thread> v;
+    for(int i=0;i<4;i++)
+        v.emplace_back([&]() { sem.acquire(2); got++; });
+    this_thread::sleep_for(50ms);
+    sem.release(5); // enough for two of them
+    this_thread::sleep_for(50ms);
+    BOOST_CHECK_EQUAL(got.load(), 2);
+    sem.release(3);
+    for(auto& t : v)
+        t.join();
+    BOOST_CHECK_EQUAL(got.load(), 4);
+    BOOST_CHECK(!sem.try_acquire(1));
+}
+
+BOOST_AUTO_TEST_CASE(semaphore_try_acquire_for)
+{
+    Semaphore sem(2);
+    // a waiter for 3 blocks the one for 1 behind it, until it times out
+    auto small = std::async(std::launch::async, [&sem]() {
+            this_thread::sleep_for(20ms);
+            return sem.try_acquire_for(1, 10s);
+        });
+    BOOST_CHECK(!sem.try_acquire_for(3, 100ms));
+    BOOST_CHECK(small.get());
+    BOOST_CHECK(sem.try_acquire(1));
+    BOOST_CHECK(!sem.try_acquire(1));
+    BOOST_CHECK_THROW(sem.acquire(-1), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(semaphore_async_wait_in_order)
+{
+    Semaphore sem;
+    std::vector<int> order;
+    sem.async_wait([&]() { order.push_back(1); });
+    sem.async_wait([&]() { order.push_back(2); });
+    sem.release(2);
+    BOOST_CHECK((order == std::vector<int>{1, 2}));
+    sem.release(1);
+    sem.async_wait([&]() { order.push_back(3); });
+    BOOST_CHECK_EQUAL(order.size(), 3u);
+}
+
+BOOST_AUTO_TEST_CASE(semaphore_callback_throws)
+{
+    Semaphore sem;
+    std::vector<int> order;
+    sem.async_wait([&]() { order.push_back(1); throw std::runtime_error("callback"); });
+    auto blocked = std::async(std::launch::async, [&sem]() { sem.acquire(1); });
+    this_thread::sleep_for(20ms); // let it queue up behind the callback
+    sem.async_wait([&]() { order.push_back(3); });
+    // the throwing callback neither strands the blocked waiter nor skips the callback after it
+    BOOST_CHECK_THROW(sem.release(3), std::runtime_error);
+    BOOST_CHECK(blocked.wait_for(5s) == std::future_status::ready);
+    BOOST_CHECK((order == std::vector<int>{1, 3}));
+    BOOST_CHECK(!sem.try_acquire(1));
+}
+
+BOOST_AUTO_TEST_CASE(light_semaphore_notify)
+{
+    LightSemaphore sem(3);
+    sem.wait();
+    sem.notify();
+    sem.wait();
+    sem.wait();
+    BOOST_CHECK(sem.try_wait());
+    BOOST_CHECK(!sem.try_wait());
+    sem.notify();
+    sem.notify();
+    sem.reset();
+    BOOST_CHECK_EQUAL(sem.value(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(light_semaphore_wait_timeout)
+{
+    auto timer_presicion = 10ms;
+    LightSemaphore sem;
+    {
+        boost::timer::cpu_timer timer;
+        BOOST_CHECK(!sem.wait_for(100ms));
+        timer.stop();
+        BOOST_CHECK(chrono::nanoseconds(timer.elapsed().wall) > 100ms - timer_presicion);
+    }
+    auto notify_process = std::async(std::launch::async, [&sem](){
+            this_thread::sleep_for(50ms);
+            sem.notify();}
+        );
+    BOOST_CHECK(sem.wait_for(10s));
+    BOOST_CHECK(!sem.try_wait());
+}
+
+BOOST_AUTO_TEST_CASE(light_semaphore_threads)
+{
+    LightSemaphore sem;
+    std::atomic<int> passed {0};
+    std::vector<std::thread> v;
+    for(int i=0;i<8;i++)
+        v.emplace_back([&]() {
+            for(int j=0;j<1000;j++) { sem.wait(); passed++; }
+        });
+    for(int j=0;j<8000;j++)
+        sem.notify();
+    for(auto& t : v)
+        t.join();
+    BOOST_CHECK_EQUAL(passed.load(), 8000);
+    BOOST_CHECK_EQUAL(sem.value(), 0u);
+}
+
+// the way Socket uses it: a semaphore on the waiter's stack, notified from another thread.
+BOOST_AUTO_TEST_CASE(light_semaphore_on_stack)
+{
+    std::atomic<LightSemaphore*> current {nullptr};
+    std::atomic<bool> stop {false};
+    std::thread notifier([&]() {
+        while (not stop)
+            if (LightSemaphore* sem = current.exchange(nullptr))
+                sem->notify();
+    });
+    for(int i=0;i<2000;i++) {
+        LightSemaphore sem;
+        current = &sem;
+        sem.wait();
+    }
+    stop = true;
+    notifier.join();
+}
+
+BOOST_AUTO_TEST_CASE(chronological_fifo)
+{
+    Semaphore_chronological sem;
+    std::mutex mtx;
+    std::vector<int> order;
+    std::vector<std::thread> v;
+    for(int i=0;i<5;i++) {
+        v.emplace_back([&, i]() {
+            sem.wait();
+            std::lock_guard<std::mutex> guard(mtx);
+            order.push_back(i);
+        });
+        this_thread::sleep_for(20ms); // let thread i queue up before thread i+1
+    }
+    for(int i=0;i<5;i++) {
+        sem.notify();
+        this_thread::sleep_for(5ms);
+    }
+    for(auto& t : v)
+        t.join();
+    BOOST_CHECK((order == std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+BOOST_AUTO_TEST_CASE(chronological_timeout_unlinks)
+{
+    Semaphore_chronological sem(1);
+    BOOST_CHECK(sem.wait_for(10ms));
+    BOOST_CHECK(!sem.wait_for(20ms));
+
+    // the timed out waiter neither took nor gave away a unit
+    auto waiter = std::async(std::launch::async, [&sem]() { return sem.wait_for(10s); });
+    this_thread::sleep_for(20ms);
+    BOOST_CHECK(!sem.wait_for(20ms));
+    sem.notify();
+    BOOST_CHECK(waiter.get());
+    BOOST_CHECK(!sem.wait_for(1ms));
+    sem.notify();
+    sem.wait();
+    BOOST_CHECK_THROW(Semaphore_chronological(1ull << 40), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(latch_count_down)
+{
+    Latch latch(4);
+    std::atomic<int> before {0};
+    std::vector<std::thread> v;
+    for(int i=0;i<4;i++)
+        v.emplace_back([&]() { before++; latch.count_down(); });
+    latch.wait();
+    BOOST_CHECK_EQUAL(before.load(), 4);
+    BOOST_CHECK(latch.try_wait());
+    for(auto& t : v)
+        t.join();
+
+    Latch over(2);
+    BOOST_CHECK_THROW(over.count_down(3), std::invalid_argument);
+    BOOST_CHECK(!over.try_wait()); // nothing counted
+    over.count_down(2);
+    BOOST_CHECK(over.try_wait());
+    over.wait();
+    BOOST_CHECK_THROW(over.count_down(), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(barrier_phases)
+{
+    constexpr int threads = 4, phases = 200;
+    int completed = 0;
+    std::atomic<int> arrived {0};
+    bool in_step = true;
+    Barrier barrier(threads, [&]() {
+        // runs alone, after everyone arrived at this phase
+        in_step = in_step && arrived.load() == (completed + 1) * threads;
+        completed++;
+    });
+    std::vector<std::thread> v;
+    for(int i=0;i<threads;i++)
+        v.emplace_back([&]() {
+            for(int p=0;p<phases;p++) {
+                arrived++;
+                barrier.arrive_and_wait();
+            }
+        });
+    for(auto& t : v)
+        t.join();
+    BOOST_CHECK_EQUAL(completed, phases);
+    BOOST_CHECK(in_step);
+    BOOST_CHECK_THROW(Barrier(0), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(eventcount_parks_consumers)
+{
+    EventCount ec;
+    std::atomic<int> items {0};
+    std::atomic<int> consumed {0};
+    constexpr int total = 20000;
+    auto try_pop = [&]() {
+        int n = items.load();
+        while (n > 0)
+            if (items.compare_exchange_weak(n, n - 1)) return true;
+        return false;
+    };
+    std::vector<std::thread> v;
+    for(int i=0;i<3;i++)
+        v.emplace_back([&]() {
+            while (consumed.load() < total) {
+                if (try_pop()) { consumed++; continue; }
+                auto key = ec.prepare_wait();
+                if (try_pop()) { ec.cancel_wait(); consumed++; continue; }
+                if (consumed.load() >= total) { ec.cancel_wait(); break; }
+                ec.commit_wait(key);
+            }
+        });
+    for(int i=0;i<total;i++) {
+        items++;
+        ec.notify();
+    }
+    while (consumed.load() < total)
+        std::this_thread::yield();
+    ec.notify_all();
+    for(auto& t : v)
+        t.join();
+    BOOST_CHECK_EQUAL(consumed.load(), total);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
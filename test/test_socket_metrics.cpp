@@ -0,0 +1,92 @@
+#define SCINART_CPPLIB_SOCKET_METRICS
+
+#include <boost/test/unit_test.hpp>
+
+#include "asio.hpp"
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(socket_metrics_test)
+
+BOOST_AUTO_TEST_CASE(test_socket_snapshot)
+{
+    for (IOMode mode : {IOMode::handoff, IOMode::inline_poll}) {
+        boost::asio::io_service io_service;
+        boost::asio::io_service::work work(io_service);
+        std::thread io([&]() { io_service.run(); });
+
+        SyncBoostIO io_server(io_service), io_client(io_service);
+        io_server.set_io_mode(mode);
+        io_client.set_io_mode(mode);
+        unsigned short port = 0;
+        io_server.listen(port);
+        std::promise<void> client_done;
+        std::thread server([&]() {
+            Socket s = io_server.accept();
+            for (int i = 0; i < 10; i++)
+                s.write(s.read<int>() + 1);
+            s.write(std::vector<char>(100000));
+            client_done.get_future().wait(); // the client times out meanwhile
+        });
+        {
+            Socket client = io_client.connect("127.0.0.1", port);
+            for (int i = 0; i < 10; i++) {
+                client.write(i);
+                BOOST_CHECK_EQUAL(client.read<int>(), i + 1);
+            }
+            BOOST_CHECK_EQUAL(client.read<char>(100000).size(), 100000u);
+            client.set_read_timeout(20ms);
+            BOOST_CHECK_THROW(client.read<int>(), boost::system::system_error);
+
+            SocketStats stats = client.snapshot();
+            BOOST_CHECK_EQUAL(stats.bytes_out, 10 * sizeof(int));
+            BOOST_CHECK_EQUAL(stats.bytes_in, 10 * sizeof(int) + 100000);
+            BOOST_CHECK_EQUAL(stats.writes, 10u);
+            BOOST_CHECK(stats.reads >= 11);
+            BOOST_CHECK_EQUAL(stats.read_ns.count(), 11u);
+            BOOST_CHECK(stats.read_ns.max() > 0);
+            BOOST_CHECK_EQUAL(stats.connect_ns.count(), 1u);
+            BOOST_CHECK_EQUAL(stats.timeouts, 1u);
+            BOOST_CHECK(stats.errors.empty());
+            client_done.set_value();
+        }
+        server.join();
+
+        // the totals outlive their sockets
+        SocketStats served = io_server.snapshot();
+        BOOST_CHECK_EQUAL(served.bytes_in, 10 * sizeof(int));
+        BOOST_CHECK_EQUAL(served.bytes_out, 10 * sizeof(int) + 100000);
+        BOOST_CHECK_EQUAL(served.read_ns.count(), 10u);
+        BOOST_CHECK_EQUAL(served.connect_ns.count(), 0u);
+        BOOST_CHECK_EQUAL(io_client.snapshot().connect_ns.count(), 1u);
+        BOOST_CHECK_EQUAL(io_client.snapshot().timeouts, 1u);
+
+        io_service.stop();
+        io.join();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_error_codes)
+{
+    boost::asio::io_service io_service;
+    unsigned short port = 0;
+    {
+        // a port nobody listens on
+        boost::asio::ip::tcp::acceptor a(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), 0));
+        port = a.local_endpoint().port();
+    }
+    SyncBoostIO io(io_service);
+    io.set_io_mode(IOMode::inline_poll);
+    BOOST_CHECK_THROW(io.connect("127.0.0.1", port), boost::system::system_error);
+    SocketStats stats = io.snapshot();
+    BOOST_CHECK_EQUAL(stats.connect_ns.count(), 0u);
+    BOOST_CHECK_EQUAL(stats.errors.size(), 1u);
+    BOOST_CHECK_EQUAL(stats.errors[boost::asio::error::connection_refused], 1u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+#include <boost/test/unit_test.hpp>
+
+#include "task_graph.hpp"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(task_graph_test)
+
+BOOST_AUTO_TEST_CASE(dependencies_and_rerun)
+{
+    TaskPool pool(4);
+    TaskGraph g;
+    std::atomic<int> step {0};
+    std::vector<int> at(6, -1);
+    auto mark = [&](int i) { return [&, i]() { at[i] = step++; }; };
+
+    auto a = g.add("a", mark(0));
+    auto b = g.add("b", mark(1));
+    auto c = g.add("c", mark(2), {a});
+    auto d = g.add("d", mark(3), {a, b});
+    auto e = g.add("e", mark(4), {c, d});
+    auto f = g.add("f", mark(5));
+    g.precede(f, e);
+
+    for (int round = 0; round < 100; round++) {
+        step = 0;
+        g.run(pool);
+        BOOST_CHECK(step == 6);
+        BOOST_CHECK(at[a] < at[c] && at[a] < at[d] && at[b] < at[d]);
+        BOOST_CHECK(at[c] < at[e] && at[d] < at[e] && at[f] < at[e]);
+    }
+    BOOST_CHECK(g.name(e) == "e");
+}
+
+BOOST_AUTO_TEST_CASE(critical_path)
+{
+    TaskPool pool(4);
+    TaskGraph g;
+    auto sleep = [](auto d) { return [d]() { std::this_thread::sleep_for(d); }; };
+    auto shard1 = g.add("shard1", sleep(50ms));
+    auto shard2 = g.add("shard2", sleep(10ms));
+    auto merge = g.add("merge", sleep(20ms), {shard1, shard2});
+    auto unite = g.add("unite", sleep(5ms), {merge});
+    g.add("side", sleep(1ms), {shard2});
+
+    g.run(pool);
+    BOOST_CHECK((g.critical_path() == std::vector<TaskGraph::Node>{shard1, merge, unite}));
+    BOOST_CHECK(g.critical_path_length() >= 75ms);
+    BOOST_CHECK(g.timing(merge).start >= g.timing(shard1).finish);
+    BOOST_CHECK(g.elapsed() >= g.critical_path_length());
+}
+
+BOOST_AUTO_TEST_CASE(errors)
+{
+    TaskPool pool(2);
+    TaskGraph g;
+    bool after_ran = false;
+    auto a = g.add("a", []() { throw std::runtime_error("a"); });
+    g.add("b", [&]() { after_ran = true; }, {a});
+    BOOST_CHECK_THROW(g.run(pool), std::runtime_error);
+    BOOST_CHECK(!after_ran);
+
+    TaskGraph cyclic;
+    auto x = cyclic.add("x", []() {});
+    auto y = cyclic.add("y", []() {}, {x});
+    cyclic.precede(y, x);
+    BOOST_CHECK_THROW(cyclic.run(pool), std::logic_error);
+    BOOST_CHECK_THROW(cyclic.precede(x, 7), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(run_join_sleeps)
+{
+    // one node sleeps on the worker; the caller, done with the others, must not spin meanwhile
+    TaskPool pool(1);
+    auto cpu_ns = []() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    };
+    auto caller = std::this_thread::get_id();
+    std::atomic<bool> slept {false};
+    TaskGraph g;
+    for (int i = 0; i < 8; i++)
+        g.add("n" + std::to_string(i), [&]() {
+            if (std::this_thread::get_id() == caller)
+                std::this_thread::sleep_for(1ms); // lets the worker pick up queued nodes
+            else if (not slept.exchange(true))
+                std::this_thread::sleep_for(200ms);
+        });
+    auto t0 = cpu_ns();
+    g.run(pool);
+    BOOST_REQUIRE(slept);
+    BOOST_CHECK(cpu_ns() - t0 < 50000000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
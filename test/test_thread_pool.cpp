@@ -3,9 +3,14 @@
 #include <boost/test/unit_test.hpp>
 
 #include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <future>
+#include <mutex>
 #include <thread>
 #include <string>
+#include <sched.h>
 
 using namespace oy;
 using namespace std::chrono_literals;
@@ -76,5 +81,164 @@ BOOST_AUTO_TEST_CASE(test_rvalue)
     f(std::move(s));
 }
 
+BOOST_AUTO_TEST_CASE(test_placement)
+{
+    auto cpus = allowed_cpus();
+    std::atomic<int> wrong_cpu {0}, count {0};
+    {
+        Distributor<int> f([&](int) {
+            if (std::find(cpus.begin(), cpus.end(), current_cpu()) == cpus.end()) wrong_cpu++;
+            count++;
+        }, Placement::cores(cpus), 4);
+        for(int i=0;i<100;i++) f(i);
+    }
+    BOOST_CHECK(count == 100);
+    BOOST_CHECK(wrong_cpu == 0);
+
+    // every worker is pinned to the cpu the placement gave it, and to nothing else:
+    // each holds one item until all of them have one, then reports its affinity mask
+    std::vector<int> placed {cpus.front(), cpus.back(), cpus.front()};
+    std::mutex mtx;
+    std::vector<int> pinned;
+    std::atomic<size_t> arrived {0};
+    {
+        Distributor<int> f([&](int) {
+            arrived++;
+            while (arrived < placed.size()) std::this_thread::sleep_for(1ms);
+            cpu_set_t set;
+            int cpu = current_cpu();
+            std::lock_guard<std::mutex> guard(mtx);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1 && CPU_ISSET(cpu, &set))
+                pinned.push_back(cpu);
+        }, Placement::cores(placed), placed.size());
+        for(size_t i=0;i<placed.size();i++) f(i);
+    }
+    std::sort(placed.begin(), placed.end());
+    std::sort(pinned.begin(), pinned.end());
+    BOOST_CHECK(pinned == placed);
+
+    BOOST_CHECK_THROW(Distributor<int>([](int){}, Placement::cores({}), 4), std::invalid_argument);
+    BOOST_CHECK_THROW(Distributor<int>([](int){}, Placement::cores({-1}), 4), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_numa_distributor)
+{
+    std::atomic<int> count {0};
+    {
+        NumaDistributor<int> f([&](int) { count++; }, 4);
+        BOOST_REQUIRE(f.size() >= 1);
+        BOOST_CHECK(f.local_node() < f.size());
+        for(int i=0;i<100;i++) f(i);
+        for(int i=0;i<100;i++) f.push(i % f.size(), i);
+    }
+    BOOST_CHECK(count == 200);
+}
+
+BOOST_AUTO_TEST_CASE(test_priority_lanes)
+{
+    std::promise<void> go;
+    auto started = go.get_future().share();
+    std::vector<int> order;
+    std::vector<int> expired;
+    {
+        // one worker, held by the first item until everything is queued.
+        PriorityDistributor<int> f([&](int i) { if (i < 0) started.wait(); else order.push_back(i); },
+                                   [&](int i) { expired.push_back(i); }, 1, 100);
+        f(-1, 0);
+        while (f.pending() != 0) std::this_thread::yield();
+        for (int i = 200; i < 205; i++) f(i, 2);
+        f(101, 1, 1h);
+        f(100, 1, 1min);
+        f(0, 0);
+        f(1, 0, std::chrono::steady_clock::now() - 1ms);
+        go.set_value();
+    }
+    BOOST_CHECK((order == std::vector<int>{0, 100, 101, 200, 201, 202, 203, 204}));
+    BOOST_CHECK((expired == std::vector<int>{1}));
+}
+
+BOOST_AUTO_TEST_CASE(test_priority_starvation)
+{
+    std::promise<void> go;
+    auto started = go.get_future().share();
+    std::vector<int> order;
+    {
+        PriorityDistributor<int, 2, 4> f([&](int i) { if (i < 0) started.wait(); else order.push_back(i); },
+                                         detail::DropExpired(), 1, 100);
+        f(-1, 0);
+        while (f.pending() != 0) std::this_thread::yield();
+        f(1000, 1);
+        for (int i = 0; i < 10; i++) f(i, 0);
+        go.set_value();
+    }
+    BOOST_CHECK((order == std::vector<int>{0, 1, 2, 3, 1000, 4, 5, 6, 7, 8, 9}));
+}
+
+BOOST_AUTO_TEST_CASE(test_priority_lane_capacity)
+{
+    std::promise<void> go;
+    auto started = go.get_future().share();
+    std::vector<int> order;
+    {
+        PriorityDistributor<int> f([&](int i) { if (i < 0) started.wait(); else order.push_back(i); },
+                                   detail::DropExpired(), 1, 2);
+        f(-1, 2);
+        while (f.pending() != 0) std::this_thread::yield();
+        f(200, 2);
+        f(201, 2);
+        auto bulk = std::async(std::launch::async, [&]() { f(202, 2); });
+        BOOST_CHECK(bulk.wait_for(50ms) == std::future_status::timeout); // the bulk lane is full
+        auto urgent = std::async(std::launch::async, [&]() { f(0, 0); f(1, 0); });
+        BOOST_CHECK(urgent.wait_for(5s) == std::future_status::ready);
+        go.set_value();
+        bulk.get();
+    }
+    BOOST_CHECK((order == std::vector<int>{0, 1, 200, 201, 202}));
+}
+
+BOOST_AUTO_TEST_CASE(test_resize)
+{
+    std::atomic<int> count {0};
+    {
+        Distributor<int> f([&](int) { std::this_thread::sleep_for(1ms); count++; }, 2, 100);
+        for(int i=0;i<50;i++) f(i);
+        f.resize(6);
+        BOOST_CHECK(f.concurrency() == 6);
+        for(int i=0;i<50;i++) f(i);
+        f.resize(1);
+        BOOST_CHECK(f.concurrency() == 1);
+        for(int i=0;i<50;i++) f(i);
+        BOOST_CHECK_THROW(f.resize(0), std::invalid_argument);
+    }
+    BOOST_CHECK(count == 150);
+}
+
+BOOST_AUTO_TEST_CASE(test_elastic)
+{
+    Elastic bounds;
+    bounds.min_workers = 1;
+    bounds.max_workers = 4;
+    bounds.spawn_depth = 2;
+    bounds.idle_timeout = 100ms;
+    std::atomic<int> count {0};
+    {
+        Distributor<Int> f([&](Int a) { add_1(std::move(a)); count++; }, bounds, 4);
+        BOOST_CHECK(f.concurrency() == 1);
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for(int i=0;i<20;i++) f(i);
+        BOOST_CHECK(f.concurrency() == 4);
+        while (count != 20) std::this_thread::sleep_for(10ms);
+        auto diff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now()-t0).count();
+        BOOST_CHECK_MESSAGE(diff_ms < 900, (std::string("it is actually ") + std::to_string(diff_ms)).c_str());
+
+        // idle workers retire down to min_workers
+        std::this_thread::sleep_for(300ms);
+        BOOST_CHECK(f.concurrency() == 1);
+        BOOST_CHECK_THROW(f.resize(5), std::invalid_argument);
+        f.resize(3);
+        for(int i=0;i<10;i++) f(i);
+    }
+    BOOST_CHECK(count == 30);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
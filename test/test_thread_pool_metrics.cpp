@@ -0,0 +1,92 @@
+#define SCINART_CPPLIB_DISTRIBUTOR_METRICS
+
+#include <boost/test/unit_test.hpp>
+
+#include "parallel.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace oy;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+// Distributors in this file are built with metrics, keep their item types to this file.
+struct Job { int id; };
+
+}
+
+BOOST_AUTO_TEST_SUITE(thread_pool_metrics_test)
+
+BOOST_AUTO_TEST_CASE(test_snapshot)
+{
+    Distributor<Job> f([](Job) { std::this_thread::sleep_for(10ms); }, 2, 2);
+    for (int i = 0; i < 10; i++) f(Job{i});
+    auto busy = f.snapshot();
+    BOOST_CHECK(busy.blocked_pushes > 0);
+    BOOST_CHECK(busy.blocked_ns > 0);
+    BOOST_CHECK(busy.workers == 2);
+
+    std::this_thread::sleep_for(100ms);
+    auto stats = f.snapshot();
+    BOOST_CHECK(stats.depth == 0);
+    BOOST_CHECK(stats.service_ns.count() == 10);
+    BOOST_CHECK(stats.wait_ns.count() == 10);
+    BOOST_CHECK(stats.service_ns.percentile(0.5) >= 8000000);
+    BOOST_CHECK(stats.wait_ns.max() >= 10000000);
+    BOOST_REQUIRE(stats.per_worker.size() == 2);
+    uint64_t items = 0;
+    for (auto& w : stats.per_worker) {
+        items += w.items;
+        BOOST_CHECK(w.busy_ratio() > 0 && w.busy_ratio() < 1);
+    }
+    BOOST_CHECK(items == 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_priority_snapshot)
+{
+    PriorityDistributor<Job> f([](Job) {}, detail::DropExpired(), 1, 4);
+    for (int i = 0; i < 10; i++) f(Job{i}, i % 3);
+    std::this_thread::sleep_for(50ms);
+    BOOST_CHECK(f.snapshot().wait_ns.count() == 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_retired_workers)
+{
+    Elastic bounds;
+    bounds.min_workers = 1;
+    bounds.max_workers = 4;
+    bounds.spawn_depth = 1;
+    bounds.idle_timeout = 20ms;
+    Distributor<Job> f([](Job) { std::this_thread::sleep_for(1ms); }, bounds, 4);
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 20; i++) f(Job{i});
+        std::this_thread::sleep_for(200ms); // the extra workers retire
+    }
+    auto stats = f.snapshot();
+    BOOST_CHECK(stats.workers == 1);
+    BOOST_CHECK(stats.per_worker.size() == 1); // no slots kept for the exited workers
+    BOOST_CHECK(stats.retired.items > 0);
+    BOOST_CHECK(stats.retired.items + stats.per_worker[0].items == 60);
+    BOOST_CHECK(stats.service_ns.count() == 60);
+    BOOST_CHECK(stats.wait_ns.count() == 60);
+}
+
+// test_parallel.cpp builds TaskPool without metrics: each build has to keep its own
+BOOST_AUTO_TEST_CASE(test_task_pool_snapshot)
+{
+    TaskPool pool(2);
+    std::atomic<int> sum {0};
+    parallel_for(pool, 0, 1000, 10, [&](int i) { sum += i; });
+    BOOST_CHECK(sum == 999 * 1000 / 2);
+    std::this_thread::sleep_for(50ms);
+    auto stats = pool.snapshot();
+    BOOST_CHECK(stats.workers == 2);
+    BOOST_CHECK(stats.wait_ns.count() > 0);
+    BOOST_CHECK(stats.wait_ns.count() >= stats.service_ns.count()); // the caller ran some tasks itself
+}
+
+BOOST_AUTO_TEST_SUITE_END()